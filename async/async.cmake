@@ -3,14 +3,38 @@ set (KORS_ASYNC_SRC
     ${CMAKE_CURRENT_LIST_DIR}/asyncable.h
     ${CMAKE_CURRENT_LIST_DIR}/processevents.h
     ${CMAKE_CURRENT_LIST_DIR}/channel.h
+    ${CMAKE_CURRENT_LIST_DIR}/boundedchannel.h
     ${CMAKE_CURRENT_LIST_DIR}/notification.h
     ${CMAKE_CURRENT_LIST_DIR}/async.h
     ${CMAKE_CURRENT_LIST_DIR}/promise.h
     ${CMAKE_CURRENT_LIST_DIR}/changednotify.h
+    ${CMAKE_CURRENT_LIST_DIR}/selector.h
+    ${CMAKE_CURRENT_LIST_DIR}/sharedchannel.h
     ${CMAKE_CURRENT_LIST_DIR}/internal/abstractinvoker.cpp
     ${CMAKE_CURRENT_LIST_DIR}/internal/abstractinvoker.h
     ${CMAKE_CURRENT_LIST_DIR}/internal/queuedinvoker.cpp
     ${CMAKE_CURRENT_LIST_DIR}/internal/queuedinvoker.h
+    ${CMAKE_CURRENT_LIST_DIR}/internal/mpscqueue.h
+    ${CMAKE_CURRENT_LIST_DIR}/internal/parking.h
+    ${CMAKE_CURRENT_LIST_DIR}/internal/priority.h
+    ${CMAKE_CURRENT_LIST_DIR}/internal/stats.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/internal/stats.h
+    ${CMAKE_CURRENT_LIST_DIR}/internal/trace.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/internal/trace.h
+    ${CMAKE_CURRENT_LIST_DIR}/internal/epoch.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/internal/epoch.h
+    ${CMAKE_CURRENT_LIST_DIR}/internal/pool.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/internal/pool.h
     ${CMAKE_CURRENT_LIST_DIR}/internal/asyncimpl.cpp
     ${CMAKE_CURRENT_LIST_DIR}/internal/asyncimpl.h
+    ${CMAKE_CURRENT_LIST_DIR}/internal/threadpool.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/internal/threadpool.h
+    ${CMAKE_CURRENT_LIST_DIR}/internal/coroutine.h
+    ${CMAKE_CURRENT_LIST_DIR}/internal/ringbuffer.h
+    ${CMAKE_CURRENT_LIST_DIR}/internal/boundedinvoker.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/internal/boundedinvoker.h
+    ${CMAKE_CURRENT_LIST_DIR}/internal/inbox.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/internal/inbox.h
+    ${CMAKE_CURRENT_LIST_DIR}/internal/sharedring.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/internal/sharedring.h
 )
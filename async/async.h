@@ -26,6 +26,7 @@ SOFTWARE.
 
 #include "asyncable.h"
 #include "internal/asyncimpl.h"
+#include "internal/threadpool.h"
 
 namespace kors::async {
 class Async
@@ -44,6 +45,43 @@ public:
         AsyncImpl::instance()->call(const_cast<Asyncable*>(caller), new AsyncImpl::FunctorArg1<F, Arg1>(f, a1), th);
     }
 
+    //! NOTE Queued into the lane of the priority of the thread `th` (see Priority)
+    template<typename F>
+    static void call(const Asyncable* caller, F f, const std::thread::id& th, Priority priority)
+    {
+        AsyncImpl::instance()->call(const_cast<Asyncable*>(caller), new AsyncImpl::Functor<F>(f), th, priority);
+    }
+
+    //! NOTE Runs `f` on a worker of the pool (see ThreadPool::instance())
+    template<typename F>
+    static void call(const Asyncable* caller, F f, ThreadPool* pool)
+    {
+        AsyncImpl::instance()->call(const_cast<Asyncable*>(caller), new AsyncImpl::Functor<F>(f), pool);
+    }
+
+    template<typename F, typename Arg1>
+    static void call(const Asyncable* caller, F f, Arg1 a1, ThreadPool* pool)
+    {
+        AsyncImpl::instance()->call(const_cast<Asyncable*>(caller), new AsyncImpl::FunctorArg1<F, Arg1>(f, a1), pool);
+    }
+
+    //! NOTE Calls `f` on the thread `th` after `delay`, from its processing of events
+    template<typename F>
+    static void callAfter(const Asyncable* caller, const std::chrono::microseconds& delay, F f,
+                          const std::thread::id& th = std::this_thread::get_id())
+    {
+        AsyncImpl::instance()->callAfter(const_cast<Asyncable*>(caller), new AsyncImpl::Functor<F>(f), delay, th);
+    }
+
+    //! NOTE Calls `f` on the thread `th` every `interval` until the caller is disconnected
+    //! (or `f` returns false, if it returns bool)
+    template<typename F>
+    static void callEvery(const Asyncable* caller, const std::chrono::microseconds& interval, F f,
+                          const std::thread::id& th = std::this_thread::get_id())
+    {
+        AsyncImpl::instance()->callEvery(const_cast<Asyncable*>(caller), new AsyncImpl::RepeatFunctor<F>(f), interval, th);
+    }
+
     static void disconnectAsync(Asyncable* a)
     {
         AsyncImpl::instance()->disconnectAsync(a);
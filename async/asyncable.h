@@ -24,9 +24,12 @@ SOFTWARE.
 #ifndef KORS_ASYNC_ASYNCABLE_H
 #define KORS_ASYNC_ASYNCABLE_H
 
-#include <set>
+#include <vector>
+#include <mutex>
 #include <cstdint>
 
+#include "internal/epoch.h"
+
 namespace kors::async {
 class Asyncable
 {
@@ -37,6 +40,22 @@ public:
         AsyncSetRepeat
     };
 
+    //! NOTE How a callback is called when it is sent from another thread
+    enum class Delivery {
+        //! NOTE By the processing of events of the thread where the callback was added
+        Queued = 0,
+        //! NOTE Right away, on the sending thread, without queueing, so the callback must be thread-safe:
+        //! it can be called concurrently by several senders, and still be running
+        //! while the receiver is disconnected on another thread
+        Direct
+    };
+
+    Asyncable() = default;
+
+    //! NOTE Connections belong to the object, they are not copied
+    Asyncable(const Asyncable&) {}
+    Asyncable& operator=(const Asyncable&) { return *this; }
+
     virtual ~Asyncable()
     {
         disconnectAll();
@@ -47,32 +66,102 @@ public:
         virtual void disconnectAsync(Asyncable* a) = 0;
     };
 
-    bool isConnectedAsync() const { return !m_connects.empty(); }
+    //! NOTE The tracker of the pending deferred calls of this object (see AsyncImpl),
+    //! it is created on the first call and connected as any other connectable,
+    //! so the pending calls are cancelled by disconnectAll.
+    //! Returns the tracker with an added reference (or nullptr if there is none and `create` is false)
+    template<typename Tracker>
+    Tracker* callsTracker(bool create = true)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_callsTracker) {
+            if (!create) {
+                return nullptr;
+            }
+            m_callsTracker = new Tracker();
+            m_connects.push_back({ m_callsTracker, 1 });
+        }
 
+        Tracker* t = static_cast<Tracker*>(m_callsTracker);
+        t->addRef();
+        return t;
+    }
+
+    bool isConnectedAsync() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return !m_connects.empty();
+    }
+
+    //! NOTE Connections are counted, a connectable (an invoker) is connected once per subscription,
+    //! and stays connected until all of them are disconnected
     void connectAsync(IConnectable* c)
     {
-        if (c && m_connects.count(c) == 0) {
-            m_connects.insert(c);
+        if (!c) {
+            return;
         }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (Connection& cn : m_connects) {
+            if (cn.connectable == c) {
+                ++cn.refs;
+                return;
+            }
+        }
+        m_connects.push_back({ c, 1 });
     }
 
     void disconnectAsync(IConnectable* c)
     {
-        m_connects.erase(c);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (size_t i = 0; i < m_connects.size(); ++i) {
+            Connection& cn = m_connects[i];
+            if (cn.connectable != c) {
+                continue;
+            }
+
+            if (--cn.refs == 0) {
+                cn = m_connects.back();
+                m_connects.pop_back();
+                if (c == m_callsTracker) {
+                    m_callsTracker = nullptr;
+                }
+            }
+            return;
+        }
     }
 
     void disconnectAll()
     {
-        auto copy = m_connects;
-        for (IConnectable* c : copy) {
-            c->disconnectAsync(this);
+        //! NOTE Connectables call back disconnectAsync, so they are called without the lock,
+        //! the connections are taken out first, so these calls find nothing to do.
+        //! A connectable released at the same time on another thread is deleted through Epoch
+        //! (see AbstractInvoker::make), the epoch is pinned before the connections are taken,
+        //! so the taken ones stay valid until they are called
+        Epoch::Guard guard;
+        std::vector<Connection> connects;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            connects.swap(m_connects);
+            m_callsTracker = nullptr;
         }
 
-        m_connects.clear();
+        for (const Connection& cn : connects) {
+            cn.connectable->disconnectAsync(this);
+        }
     }
 
 private:
-    std::set<IConnectable*> m_connects;
+    struct Connection {
+        IConnectable* connectable = nullptr;
+        int refs = 0;
+    };
+
+    mutable std::mutex m_mutex;
+
+    //! NOTE Flat, objects have a few connectables, each is connected once per its subscriptions
+    std::vector<Connection> m_connects;
+    IConnectable* m_callsTracker = nullptr;
 };
 }
 
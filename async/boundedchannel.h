@@ -0,0 +1,132 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef KORS_ASYNC_BOUNDEDCHANNEL_H
+#define KORS_ASYNC_BOUNDEDCHANNEL_H
+
+#include <memory>
+#include "internal/boundedinvoker.h"
+
+namespace kors::async {
+//! NOTE Channel with a queue of a fixed capacity per receiver thread,
+//! when a receiver thread lags behind, the values are handled according to the overflow policy,
+//! instead of growing its queue without a limit.
+//! Receivers of the sending thread are called directly, as for Channel.
+template<typename ... T>
+class BoundedChannel
+{
+public:
+    explicit BoundedChannel(size_t capacity, OverflowPolicy overflow = OverflowPolicy::Block)
+        : m_ptr(AbstractInvoker::make<BoundedInvoker>(Receive, capacity, overflow)) {}
+
+    BoundedChannel(const BoundedChannel& ch)
+        : m_ptr(ch.m_ptr) {}
+    ~BoundedChannel() {}
+
+    BoundedChannel& operator=(const BoundedChannel& ch)
+    {
+        m_ptr = ch.m_ptr;
+        return *this;
+    }
+
+    //! NOTE Returns false if the value was dropped or failed for some receiver thread
+    bool send(const T&... d)
+    {
+        NotifyData nd;
+        nd.setArgs<T...>(d ...);
+        return m_ptr->send(std::move(nd), false);
+    }
+
+    template<bool HasArgs = (sizeof...(T) > 0), std::enable_if_t<HasArgs, int> = 0>
+    bool send(T&&... d)
+    {
+        NotifyData nd;
+        nd.setArgs<T...>(std::move(d)...);
+        return m_ptr->send(std::move(nd), false);
+    }
+
+    //! NOTE Never waits, returns false if the queue of some receiver thread is full
+    bool trySend(const T&... d)
+    {
+        NotifyData nd;
+        nd.setArgs<T...>(d ...);
+        return m_ptr->send(std::move(nd), true);
+    }
+
+    template<typename Func>
+    void onReceive(const Asyncable* receiver, Func f, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetOnce)
+    {
+        m_ptr->addCallBack(Receive, const_cast<Asyncable*>(receiver), new ReceiveCall<Func, T...>(f), mode);
+    }
+
+    void resetOnReceive(const Asyncable* receiver)
+    {
+        m_ptr->removeCallBack(Receive, const_cast<Asyncable*>(receiver));
+    }
+
+    //! NOTE Delivered after the values sent before
+    void close()
+    {
+        m_ptr->invoke(Close);
+    }
+
+    template<typename Func>
+    void onClose(const Asyncable* receiver, Func f, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetOnce)
+    {
+        m_ptr->addCallBack(Close, const_cast<Asyncable*>(receiver), new CloseCall<Func>(f), mode);
+    }
+
+    bool isConnected() const
+    {
+        return m_ptr->isConnected();
+    }
+
+private:
+
+    enum CallType {
+        Undefined = 0,
+        Receive,
+        Close
+    };
+
+    template<typename Call, typename ... Arg>
+    struct ReceiveCall : public AbstractInvoker::ICall {
+        Call f;
+        ReceiveCall(Call _f)
+            : f(_f) {}
+        void call(const NotifyData& d) override { d.apply<Arg...>(f); }
+    };
+
+    template<typename Call>
+    struct CloseCall : public AbstractInvoker::ICall {
+        Call f;
+        CloseCall(Call _f)
+            : f(_f) {}
+        void call(const NotifyData&) override { f(); }
+    };
+
+    std::shared_ptr<BoundedInvoker> m_ptr;
+};
+}
+
+#endif // KORS_ASYNC_BOUNDEDCHANNEL_H
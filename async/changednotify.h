@@ -24,6 +24,11 @@ SOFTWARE.
 #ifndef KORS_ASYNC_CHANGEDNOTIFIER_H
 #define KORS_ASYNC_CHANGEDNOTIFIER_H
 
+#include <vector>
+#include <utility>
+#include <mutex>
+#include <atomic>
+
 #include "internal/abstractinvoker.h"
 
 namespace kors::async {
@@ -40,9 +45,10 @@ public:
     ~ChangedNotify() {}
 
     template<typename Call>
-    void onChanged(Asyncable* caller, Call f, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetOnce)
+    void onChanged(Asyncable* caller, Call f, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetOnce,
+                   Asyncable::Delivery delivery = Asyncable::Delivery::Queued)
     {
-        ptr()->addCallBack(Changed, caller, new ChangedCall<Call>(f), mode);
+        ptr()->addCallBack(Changed, caller, new ChangedCall<Call>(f), mode, delivery == Asyncable::Delivery::Direct);
     }
 
     void resetOnChanged(Asyncable* caller)
@@ -51,9 +57,10 @@ public:
     }
 
     template<typename Call>
-    void onItemChanged(Asyncable* caller, Call f, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetOnce)
+    void onItemChanged(Asyncable* caller, Call f, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetOnce,
+                       Asyncable::Delivery delivery = Asyncable::Delivery::Queued)
     {
-        ptr()->addCallBack(ItemChanged, caller, new ItemChangedCallT<Call, T>(f), mode);
+        ptr()->addCallBack(ItemChanged, caller, new ItemCall<Call>(f), mode, delivery == Asyncable::Delivery::Direct);
     }
 
     void resetOnItemChanged(Asyncable* caller)
@@ -62,9 +69,10 @@ public:
     }
 
     template<typename Call>
-    void onItemAdded(Asyncable* caller, Call f, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetOnce)
+    void onItemAdded(Asyncable* caller, Call f, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetOnce,
+                     Asyncable::Delivery delivery = Asyncable::Delivery::Queued)
     {
-        ptr()->addCallBack(ItemAdded, caller, new ItemAddedCallT<Call, T>(f), mode);
+        ptr()->addCallBack(ItemAdded, caller, new ItemCall<Call>(f), mode, delivery == Asyncable::Delivery::Direct);
     }
 
     void resetOnItemAdded(Asyncable* caller)
@@ -73,9 +81,10 @@ public:
     }
 
     template<typename Call>
-    void onItemRemoved(Asyncable* caller, Call f, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetOnce)
+    void onItemRemoved(Asyncable* caller, Call f, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetOnce,
+                       Asyncable::Delivery delivery = Asyncable::Delivery::Queued)
     {
-        ptr()->addCallBack(ItemRemoved, caller, new ItemRemovedCallT<Call, T>(f), mode);
+        ptr()->addCallBack(ItemRemoved, caller, new ItemCall<Call>(f), mode, delivery == Asyncable::Delivery::Direct);
     }
 
     void resetOnItemRemoved(Asyncable* caller)
@@ -84,9 +93,10 @@ public:
     }
 
     template<typename Call>
-    void onItemReplaced(Asyncable* caller, Call f, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetOnce)
+    void onItemReplaced(Asyncable* caller, Call f, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetOnce,
+                        Asyncable::Delivery delivery = Asyncable::Delivery::Queued)
     {
-        ptr()->addCallBack(ItemReplaced, caller, new ItemReplacedCallT<Call, T>(f), mode);
+        ptr()->addCallBack(ItemReplaced, caller, new ItemReplacedCall<Call>(f), mode, delivery == Asyncable::Delivery::Direct);
     }
 
     void resetOnItemReplaced(Asyncable* caller)
@@ -94,156 +104,155 @@ public:
         ptr()->removeCallBack(ItemReplaced, caller);
     }
 
+    //! NOTE Range receivers, `f(const std::vector<T>& items)`,
+    //! get the items of a range (or of a batch, see ChangedNotifier::beginUpdate) at once,
+    //! a single item is delivered as a range of one
+    template<typename Call>
+    void onItemsChanged(Asyncable* caller, Call f, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetOnce,
+                        Asyncable::Delivery delivery = Asyncable::Delivery::Queued)
+    {
+        ptr()->addCallBack(ItemsChanged, caller, new ItemsCall<Call>(f), mode, delivery == Asyncable::Delivery::Direct);
+    }
+
+    void resetOnItemsChanged(Asyncable* caller)
+    {
+        ptr()->removeCallBack(ItemsChanged, caller);
+    }
+
+    template<typename Call>
+    void onItemsAdded(Asyncable* caller, Call f, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetOnce,
+                      Asyncable::Delivery delivery = Asyncable::Delivery::Queued)
+    {
+        ptr()->addCallBack(ItemsAdded, caller, new ItemsCall<Call>(f), mode, delivery == Asyncable::Delivery::Direct);
+    }
+
+    void resetOnItemsAdded(Asyncable* caller)
+    {
+        ptr()->removeCallBack(ItemsAdded, caller);
+    }
+
+    template<typename Call>
+    void onItemsRemoved(Asyncable* caller, Call f, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetOnce,
+                        Asyncable::Delivery delivery = Asyncable::Delivery::Queued)
+    {
+        ptr()->addCallBack(ItemsRemoved, caller, new ItemsCall<Call>(f), mode, delivery == Asyncable::Delivery::Direct);
+    }
+
+    void resetOnItemsRemoved(Asyncable* caller)
+    {
+        ptr()->removeCallBack(ItemsRemoved, caller);
+    }
+
     enum CallType {
         Undefined = 0,
         Changed,
         ItemChanged,
         ItemAdded,
         ItemRemoved,
-        ItemReplaced
+        ItemReplaced,
+        ItemsChanged,
+        ItemsAdded,
+        ItemsRemoved
     };
 
 private:
     friend class ChangedNotifier<T>;
 
-    struct IChanged {
-        virtual ~IChanged() = default;
-        virtual void changed() = 0;
-    };
+    using Items = std::vector<T>;
+    using Replacements = std::vector<std::pair<T, T> >;
 
     template<typename Call>
-    struct ChangedCall : public IChanged {
+    struct ChangedCall : public AbstractInvoker::ICall {
         Call f;
         ChangedCall(Call _f)
             : f(_f) {}
-        void changed() { f(); }
-    };
-
-    struct IItemChanged {
-        virtual ~IItemChanged() = default;
-        virtual void itemChanged(const NotifyData& item) = 0;
+        void call(const NotifyData&) override { f(); }
     };
 
-    template<typename Call, typename Arg>
-    struct ItemChangedCallT : public IItemChanged {
+    //! NOTE The data is a single item or a range of items
+    template<typename Call>
+    struct ItemCall : public AbstractInvoker::ICall {
         Call f;
-        ItemChangedCallT(Call _f)
+        ItemCall(Call _f)
             : f(_f) {}
-        void itemChanged(const NotifyData& item) { f(item.arg<Arg>()); }
-    };
+        void call(const NotifyData& data) override
+        {
+            if (data.holds<T>()) {
+                data.apply<T>(f);
+                return;
+            }
 
-    struct IItemAdded {
-        virtual ~IItemAdded() = default;
-        virtual void itemAdded(const NotifyData& item) = 0;
+            for (const T& item : std::get<0>(data.args<Items>())) {
+                f(item);
+            }
+        }
     };
 
-    template<typename Call, typename Arg>
-    struct ItemAddedCallT : public IItemAdded {
+    template<typename Call>
+    struct ItemsCall : public AbstractInvoker::ICall {
         Call f;
-        ItemAddedCallT(Call _f)
+        ItemsCall(Call _f)
             : f(_f) {}
-        void itemAdded(const NotifyData& item) { f(item.arg<Arg>()); }
-    };
+        void call(const NotifyData& data) override
+        {
+            if (data.holds<Items>()) {
+                data.apply<Items>(f);
+                return;
+            }
 
-    struct IItemRemoved {
-        virtual ~IItemRemoved() = default;
-        virtual void itemRemoved(const NotifyData& item) = 0;
+            f(Items { std::get<0>(data.args<T>()) });
+        }
     };
 
-    template<typename Call, typename Arg>
-    struct ItemRemovedCallT : public IItemRemoved {
+    template<typename Call>
+    struct ItemReplacedCall : public AbstractInvoker::ICall {
         Call f;
-        ItemRemovedCallT(Call _f)
+        ItemReplacedCall(Call _f)
             : f(_f) {}
-        void itemRemoved(const NotifyData& item) { f(item.arg<Arg>()); }
-    };
-
-    struct IItemReplaced {
-        virtual ~IItemReplaced() = default;
-        virtual void itemReplaced(const NotifyData& item) = 0;
-    };
+        void call(const NotifyData& data) override
+        {
+            if (data.holds<T, T>()) {
+                data.apply<T, T>(f);
+                return;
+            }
 
-    template<typename Call, typename Arg>
-    struct ItemReplacedCallT : public IItemReplaced {
-        Call f;
-        ItemReplacedCallT(Call _f)
-            : f(_f) {}
-        void itemReplaced(const NotifyData& item) { f(item.arg<Arg>(0), item.arg<Arg>(1)); }
+            for (const auto& r : std::get<0>(data.args<Replacements>())) {
+                f(r.first, r.second);
+            }
+        }
     };
 
     struct ChangedInvoker : public AbstractInvoker
     {
         friend class ChangedNotify<T>;
+        friend class ChangedNotifier<T>;
 
         ChangedInvoker() = default;
         ~ChangedInvoker()
         {
             removeAllCallBacks();
         }
-
-        void deleteCall(int _type, void* call) override
-        {
-            CallType type = static_cast<CallType>(_type);
-            switch (type) {
-            case Undefined: {} break;
-            case Changed:     {
-                delete static_cast<IChanged*>(call);
-            } break;
-            case ItemChanged:   {
-                delete static_cast<IItemChanged*>(call);
-            } break;
-            case ItemAdded:   {
-                delete static_cast<IItemAdded*>(call);
-            } break;
-            case ItemRemoved: {
-                delete static_cast<IItemRemoved*>(call);
-            } break;
-            case ItemReplaced: {
-                delete static_cast<IItemReplaced*>(call);
-            } break;
-            }
-        }
-
-        void doInvoke(int callKey, void* call, const NotifyData& d) override
-        {
-            switch (callKey) {
-            case Undefined: return;
-            case Changed: {
-                static_cast<IChanged*>(call)->changed();
-            } break;
-            case ItemChanged: {
-                static_cast<IItemChanged*>(call)->itemChanged(d);
-            } break;
-            case ItemAdded: {
-                static_cast<IItemAdded*>(call)->itemAdded(d);
-            } break;
-            case ItemRemoved: {
-                static_cast<IItemRemoved*>(call)->itemRemoved(d);
-            } break;
-            case ItemReplaced: {
-                static_cast<IItemReplaced*>(call)->itemReplaced(d);
-            } break;
-            }
-        }
     };
 
-    std::shared_ptr<ChangedInvoker> ptr() const
+    //! NOTE The invoker is created with the notify, so it is borrowed without touching its refcount
+    const std::shared_ptr<ChangedInvoker>& ptr() const
     {
-        if (!m_ptr) {
-            m_ptr = std::make_shared<ChangedInvoker>();
-        }
         return m_ptr;
     }
 
-    mutable std::shared_ptr<ChangedInvoker> m_ptr = nullptr;
+    std::shared_ptr<ChangedInvoker> m_ptr = AbstractInvoker::make<ChangedInvoker>();
 };
 
 template<typename T>
 class ChangedNotifier
 {
+    using Notify = ChangedNotify<T>;
+    using Items = typename Notify::Items;
+    using Replacements = typename Notify::Replacements;
+
 public:
     ChangedNotifier()
-        : m_notify(std::make_shared<ChangedNotify<T> >()) {}
+        : m_notify(std::make_shared<Notify>()), m_update(std::make_shared<Update>()) {}
     ~ChangedNotifier() {}
 
     std::shared_ptr<ChangedNotify<T> > notify() const
@@ -251,46 +260,184 @@ public:
         return m_notify;
     }
 
+    //! NOTE Starts a batch (can be nested), the changes are not sent until the outermost `endUpdate`.
+    //! Then consecutive changes of the same kind are sent as one range (one delivery per receiver thread),
+    //! the order of the kinds is kept, `changed` is sent once after them
+    void beginUpdate()
+    {
+        std::lock_guard lock(m_update->mutex);
+        m_update->depth.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void endUpdate()
+    {
+        std::vector<Run> runs;
+        bool changed = false;
+        {
+            std::lock_guard lock(m_update->mutex);
+            assert(m_update->depth.load(std::memory_order_relaxed) > 0);
+            if (m_update->depth.fetch_sub(1, std::memory_order_relaxed) != 1) {
+                return;
+            }
+
+            runs.swap(m_update->runs);
+            changed = m_update->changed;
+            m_update->changed = false;
+        }
+
+        for (Run& r : runs) {
+            NotifyData d;
+            if (r.type == Notify::ItemReplaced) {
+                d.setArgs<Replacements>(std::move(r.replacements));
+                m_notify->ptr()->invoke(Notify::ItemReplaced, std::move(d));
+            } else {
+                d.setArgs<Items>(std::move(r.items));
+                send(r.type, std::move(d));
+            }
+        }
+
+        if (changed) {
+            m_notify->ptr()->invoke(Notify::Changed);
+        }
+    }
+
     void changed()
     {
-        m_notify->ptr()->invoke(ChangedNotify<T>::Changed);
+        if (isUpdating()) {
+            std::lock_guard lock(m_update->mutex);
+            if (m_update->depth.load(std::memory_order_relaxed) > 0) {
+                m_update->changed = true;
+                return;
+            }
+        }
+
+        m_notify->ptr()->invoke(Notify::Changed);
+    }
+
+    //! NOTE Multiple `changed` are delivered at most once per processing of the receiver thread
+    void setConflated(bool conflated)
+    {
+        m_notify->ptr()->setConflated(Notify::Changed, conflated);
     }
 
-    void itemChanged(const T& item)
+    void itemChanged(const T& item) { sendItem(Notify::ItemChanged, item); }
+    void itemChanged(T&& item) { sendItem(Notify::ItemChanged, std::move(item)); }
+    void itemsChanged(const std::vector<T>& items) { sendItems(Notify::ItemChanged, items); }
+
+    void itemAdded(const T& item) { sendItem(Notify::ItemAdded, item); }
+    void itemAdded(T&& item) { sendItem(Notify::ItemAdded, std::move(item)); }
+    void itemsAdded(const std::vector<T>& items) { sendItems(Notify::ItemAdded, items); }
+
+    void itemRemoved(const T& item) { sendItem(Notify::ItemRemoved, item); }
+    void itemRemoved(T&& item) { sendItem(Notify::ItemRemoved, std::move(item)); }
+    void itemsRemoved(const std::vector<T>& items) { sendItems(Notify::ItemRemoved, items); }
+
+    void itemReplaced(const T& oldItem, const T& newItem)
     {
+        if (isUpdating()) {
+            std::lock_guard lock(m_update->mutex);
+            if (m_update->depth.load(std::memory_order_relaxed) > 0) {
+                run(Notify::ItemReplaced).replacements.emplace_back(oldItem, newItem);
+                return;
+            }
+        }
+
         NotifyData d;
-        d.setArg<T>(0, item);
+        d.setArgs<T, T>(oldItem, newItem);
 
-        m_notify->ptr()->invoke(ChangedNotify<T>::ItemChanged, d);
+        m_notify->ptr()->invoke(Notify::ItemReplaced, std::move(d));
     }
 
-    void itemAdded(const T& item)
+private:
+    struct Run {
+        int type = 0;
+        Items items;
+        Replacements replacements;
+    };
+
+    struct Update {
+        std::mutex mutex;
+        std::atomic<int> depth = 0;
+        bool changed = false;
+        std::vector<Run> runs;
+    };
+
+    static int rangeType(int type)
     {
-        NotifyData d;
-        d.setArg<T>(0, item);
+        switch (type) {
+        case Notify::ItemChanged: return Notify::ItemsChanged;
+        case Notify::ItemAdded: return Notify::ItemsAdded;
+        case Notify::ItemRemoved: return Notify::ItemsRemoved;
+        }
+        return Notify::Undefined;
+    }
 
-        m_notify->ptr()->invoke(ChangedNotify<T>::ItemAdded, d);
+    bool isUpdating() const
+    {
+        return m_update->depth.load(std::memory_order_relaxed) > 0;
     }
 
-    void itemRemoved(const T& item)
+    //! NOTE Called under the update lock
+    Run& run(int type)
     {
-        NotifyData d;
-        d.setArg<T>(0, item);
+        std::vector<Run>& runs = m_update->runs;
+        if (runs.empty() || runs.back().type != type) {
+            runs.push_back(Run { type, {}, {} });
+        }
+        return runs.back();
+    }
 
-        m_notify->ptr()->invoke(ChangedNotify<T>::ItemRemoved, d);
+    template<typename V>
+    void sendItem(int type, V&& item)
+    {
+        if (isUpdating()) {
+            std::lock_guard lock(m_update->mutex);
+            if (m_update->depth.load(std::memory_order_relaxed) > 0) {
+                run(type).items.push_back(std::forward<V>(item));
+                return;
+            }
+        }
+
+        NotifyData d;
+        d.setArgs<T>(std::forward<V>(item));
+        send(type, std::move(d));
     }
 
-    void itemReplaced(const T& oldItem, const T& newItem)
+    void sendItems(int type, const Items& items)
     {
+        if (items.empty()) {
+            return;
+        }
+
+        if (isUpdating()) {
+            std::lock_guard lock(m_update->mutex);
+            if (m_update->depth.load(std::memory_order_relaxed) > 0) {
+                Items& buf = run(type).items;
+                buf.insert(buf.end(), items.begin(), items.end());
+                return;
+            }
+        }
+
         NotifyData d;
-        d.setArg<T>(0, oldItem);
-        d.setArg<T>(1, newItem);
+        d.setArgs<Items>(items);
+        send(type, std::move(d));
+    }
 
-        m_notify->ptr()->invoke(ChangedNotify<T>::ItemReplaced, d);
+    //! NOTE The same data (an item or a range) goes to the item receivers and to the range receivers
+    void send(int type, NotifyData&& d)
+    {
+        const auto& inv = m_notify->ptr();
+        int range = rangeType(type);
+        if (inv->hasCallBacks(range)) {
+            inv->invoke(type, d);
+            inv->invoke(range, std::move(d));
+        } else {
+            inv->invoke(type, std::move(d));
+        }
     }
 
-private:
     std::shared_ptr<ChangedNotify<T> > m_notify;
+    std::shared_ptr<Update> m_update;
 };
 }
 
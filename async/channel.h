@@ -25,7 +25,9 @@ SOFTWARE.
 #define KORS_ASYNC_CHANNEL_H
 
 #include <memory>
+#include <optional>
 #include "internal/abstractinvoker.h"
+#include "internal/coroutine.h"
 
 namespace kors::async {
 template<typename ... T>
@@ -50,14 +52,26 @@ public:
     void send(const T&... d)
     {
         NotifyData nd;
-        nd.setArg<T...>(0, d ...);
-        ptr()->invoke(Receive, nd);
+        nd.setArgs<T...>(d ...);
+        ptr()->invoke(Receive, std::move(nd));
+    }
+
+    //! NOTE A single receiver gets the moved value,
+    //! multiple receivers share one value (by const reference)
+    template<bool HasArgs = (sizeof...(T) > 0), std::enable_if_t<HasArgs, int> = 0>
+    void send(T&&... d)
+    {
+        NotifyData nd;
+        nd.setArgs<T...>(std::move(d)...);
+        ptr()->invoke(Receive, std::move(nd));
     }
 
     template<typename Func>
-    void onReceive(const Asyncable* receiver, Func f, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetOnce)
+    void onReceive(const Asyncable* receiver, Func f, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetOnce,
+                   Asyncable::Delivery delivery = Asyncable::Delivery::Queued)
     {
-        ptr()->addCallBack(Receive, const_cast<Asyncable*>(receiver), new ReceiveCall<Func, T...>(f), mode);
+        ptr()->addCallBack(Receive, const_cast<Asyncable*>(receiver), new ReceiveCall<Func, T...>(f), mode,
+                           delivery == Asyncable::Delivery::Direct);
     }
 
     void resetOnReceive(const Asyncable* receiver)
@@ -78,10 +92,73 @@ public:
 
     bool isConnected() const
     {
-        return m_ptr && ptr()->isConnected();
+        return m_ptr->isConnected();
+    }
+
+    //! NOTE See Stats
+    uint64_t deliveryCount() const
+    {
+        return m_ptr->deliveryCount();
+    }
+
+    //! NOTE Only the latest not yet delivered value is kept for each receiver thread
+    //! (for progress, telemetry and the like), receivers of the sending thread get all values
+    void setConflated(bool conflated)
+    {
+        ptr()->setConflated(Receive, conflated);
+    }
+
+    //! NOTE Values for other threads are delivered with this priority (see Priority)
+    void setPriority(Priority priority)
+    {
+        ptr()->setPriority(priority);
+    }
+
+#ifdef KORS_ASYNC_COROUTINES
+    using Value = typename ValueOf<T...>::type;
+
+    //! NOTE `co_await channel.receive()` suspends the coroutine until the next value is sent,
+    //! the coroutine is resumed on the awaiting thread. Returns the value (a tuple for several values),
+    //! or nullopt if the channel is closed. Values sent while no one awaits are not received.
+    struct ReceiveAwaiter : public Asyncable {
+        Channel ch;
+        std::optional<Value> value;
+
+        ReceiveAwaiter(const Channel& c)
+            : ch(c) {}
+
+        bool await_ready() const
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            ch.onReceive(this, [this, h](auto&&... val) {
+                value.emplace(std::forward<decltype(val)>(val)...);
+                disconnectAll();
+                h.resume();
+            });
+            ch.onClose(this, [this, h]() {
+                disconnectAll();
+                h.resume();
+            });
+        }
+
+        std::optional<Value> await_resume()
+        {
+            return std::move(value);
+        }
+    };
+
+    ReceiveAwaiter receive() const
+    {
+        return ReceiveAwaiter(*this);
     }
+#endif
 
 private:
+    friend class Selector;
 
     enum CallType {
         Undefined = 0,
@@ -89,80 +166,41 @@ private:
         Close
     };
 
-    struct IReceive {
-        virtual ~IReceive() {}
-        virtual void received(const NotifyData& d) = 0;
-    };
-
     template<typename Call, typename ... Arg>
-    struct ReceiveCall : public IReceive {
+    struct ReceiveCall : public AbstractInvoker::ICall {
         Call f;
         ReceiveCall(Call _f)
             : f(_f) {}
-        void received(const NotifyData& d) { std::apply(f, d.args<Arg...>()); }
-    };
-
-    struct IClose {
-        virtual ~IClose() {}
-        virtual void closed() = 0;
+        void call(const NotifyData& d) override { d.apply<Arg...>(f); }
     };
 
     template<typename Call>
-    struct CloseCall : public IClose {
+    struct CloseCall : public AbstractInvoker::ICall {
         Call f;
         CloseCall(Call _f)
             : f(_f) {}
-        void closed() { f(); }
+        void call(const NotifyData&) override { f(); }
     };
 
     struct ChannelInvoker : public AbstractInvoker
     {
         friend class Channel;
+        friend class Selector;
 
         ChannelInvoker() = default;
         ~ChannelInvoker()
         {
             removeAllCallBacks();
         }
-
-        void deleteCall(int _type, void* call) override
-        {
-            CallType type = static_cast<CallType>(_type);
-            switch (type) {
-            case Undefined: {} break;
-            case Receive: {
-                delete static_cast<IReceive*>(call);
-            } break;
-            case Close: {
-                delete static_cast<IClose*>(call);
-            } break;
-            }
-        }
-
-        void doInvoke(int callKey, void* call, const NotifyData& d) override
-        {
-            CallType type = static_cast<CallType>(callKey);
-            switch (type) {
-            case Undefined:  break;
-            case Receive:
-                static_cast<IReceive*>(call)->received(d);
-                break;
-            case Close:
-                static_cast<IClose*>(call)->closed();
-                break;
-            }
-        }
     };
 
-    std::shared_ptr<ChannelInvoker> ptr() const
+    //! NOTE The invoker is created with the channel, so it is borrowed without touching its refcount
+    const std::shared_ptr<ChannelInvoker>& ptr() const
     {
-        if (!m_ptr) {
-            m_ptr = std::make_shared<ChannelInvoker>();
-        }
         return m_ptr;
     }
 
-    mutable std::shared_ptr<ChannelInvoker> m_ptr = nullptr;
+    std::shared_ptr<ChannelInvoker> m_ptr = AbstractInvoker::make<ChannelInvoker>();
 };
 }
 
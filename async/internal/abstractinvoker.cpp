@@ -26,18 +26,37 @@ SOFTWARE.
 #include <cassert>
 
 #include "queuedinvoker.h"
+#include "trace.h"
 
 using namespace kors::async;
 
+//! NOTE The thread of the direct callbacks, they are called on any sending thread
+static const std::thread::id DIRECT = std::thread::id();
+
 AbstractInvoker::AbstractInvoker()
 {
 }
 
 AbstractInvoker::~AbstractInvoker()
 {
-    std::lock_guard<std::mutex> lock(m_qInvokersMutex);
-    for (QInvoker* qi : m_qInvokers) {
-        qi->invalidate();
+    setCallbacks(nullptr);
+
+    const Slots* slots = m_slots.exchange(nullptr, std::memory_order_acq_rel);
+    if (slots) {
+        Epoch::instance()->retire(const_cast<Slots*>(slots));
+    }
+}
+
+const AbstractInvoker::CallBacksTable* AbstractInvoker::loadCallbacks() const
+{
+    return m_callbacks.load(std::memory_order_acquire);
+}
+
+void AbstractInvoker::setCallbacks(const CallBacksTable* callbacks)
+{
+    const CallBacksTable* old = m_callbacks.exchange(callbacks, std::memory_order_acq_rel);
+    if (old) {
+        Epoch::instance()->retire(const_cast<CallBacksTable*>(old));
     }
 }
 
@@ -48,46 +67,217 @@ void AbstractInvoker::invoke(int type)
 
 void AbstractInvoker::invoke(int type, const NotifyData& data)
 {
-    auto it = m_callbacks.find(type);
-    if (it == m_callbacks.end()) {
-        return;
-    }
+    invoke(type, data, nullptr);
+}
 
-    std::thread::id threadID = std::this_thread::get_id();
+void AbstractInvoker::invoke(int type, NotifyData&& data)
+{
+    invoke(type, data, &data);
+}
 
-    //! NOTE: explicit copy because collection can be modified from elsewhere
-    CallBacks callbacks = it->second;
+void AbstractInvoker::invoke(int type, const NotifyData& data, const std::shared_ptr<void>& keepAlive)
+{
+    invoke(type, data, nullptr, &keepAlive);
+}
 
-    for (const CallBack& c : callbacks) {
-        if (!it->second.containsReceiver(c.receiver)) {
-            std::cout << "Skipping removed receiver";
-            continue;
+void AbstractInvoker::invoke(int type, const NotifyData& data, NotifyData* ownedData, const std::shared_ptr<void>* keepAlive)
+{
+    Trace::Scope scope("send");
+
+    //! NOTE The data is copied (or moved, if owned) at most once,
+    //! all destination threads and receivers share it
+    const NotifyData* localData = &data;
+    std::shared_ptr<SharedData> shared;
+    LocalCalls local;
+    {
+        //! NOTE The snapshot is not modified, it stays valid while the epoch is pinned
+        Epoch::Guard guard;
+        const CallBacksTable* snapshot = loadCallbacks();
+        if (!snapshot) {
+            return;
         }
-        if (c.threadID == threadID) {
-            invokeCallback(type, c, data);
-        } else {
-            QInvoker* qi = new QInvoker(this, type, c, data);
-            QueuedInvoker::instance()->invoke(c.threadID, [qi]() {
+
+        const CallBacks* found = snapshot->find(type);
+        if (!found) {
+            return;
+        }
+
+        std::thread::id threadID = std::this_thread::get_id();
+        const CallBacks& callbacks = *found;
+#ifdef KORS_ASYNC_STATS
+        m_deliveries.fetch_add(callbacks.size(), std::memory_order_relaxed);
+#endif
+
+        //! NOTE First post one batch per destination thread, then call receivers of this thread
+        std::vector<QInvoker*> queued;
+        for (size_t i = 0; i < callbacks.size(); ++i) {
+            const CallBack& c = callbacks.at(i);
+            if (c.threadID == threadID || c.threadID == DIRECT) {
+                local.add(c.call);
+                continue;
+            }
+
+            QInvoker* qi = nullptr;
+            for (QInvoker* q : queued) {
+                if (q->threadID == c.threadID) {
+                    qi = q;
+                    break;
+                }
+            }
+
+            if (!qi) {
+                qi = new QInvoker(c.threadID);
+                if (keepAlive) {
+                    qi->keepAlive = *keepAlive;
+                }
+                queued.push_back(qi);
+            }
+
+            qi->add(c);
+        }
+
+        if (queued.size() == 1 && local.empty()) {
+            QInvoker* qi = queued.front();
+            if (ownedData) {
+                qi->ownData = std::move(*ownedData);
+            } else {
+                qi->ownData = data;
+            }
+        } else if (!queued.empty()) {
+            shared = std::allocate_shared<SharedData>(PoolAllocator<SharedData>());
+            if (ownedData) {
+                shared->data = std::move(*ownedData);
+            } else {
+                shared->data = data;
+            }
+            shared->readers.store(int(queued.size()) + (local.empty() ? 0 : 1), std::memory_order_relaxed);
+
+            for (QInvoker* qi : queued) {
+                qi->sharedData = shared;
+            }
+            localData = &shared->data;
+            ownedData = nullptr;
+        }
+
+        bool conflated = isConflated(type);
+        Priority prio = priority();
+        for (QInvoker* qi : queued) {
+            if (conflated) {
+                postConflated(type, qi);
+                continue;
+            }
+
+            //! NOTE The thread has exited
+            if (!QueuedInvoker::instance()->invoke(qi->threadID, [qi]() {
                 qi->invoke();
                 delete qi;
-            });
+            }, false, prio)) {
+                delete qi;
+            }
         }
     }
+
+    local.call(*localData, ownedData);
+
+    if (shared && !local.empty()) {
+        shared->readers.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void AbstractInvoker::setConflated(int type, bool conflated)
+{
+    assert(type >= 0 && type < 32);
+    uint32_t bit = uint32_t(1) << type;
+    if (conflated) {
+        m_conflated.fetch_or(bit, std::memory_order_relaxed);
+    } else {
+        m_conflated.fetch_and(~bit, std::memory_order_relaxed);
+    }
+}
+
+bool AbstractInvoker::isConflated(int type) const
+{
+    return m_conflated.load(std::memory_order_relaxed) & (uint32_t(1) << type);
+}
+
+void AbstractInvoker::setPriority(Priority priority)
+{
+    m_priority.store(priority, std::memory_order_relaxed);
+}
+
+Priority AbstractInvoker::priority() const
+{
+    return m_priority.load(std::memory_order_relaxed);
+}
+
+const std::shared_ptr<AbstractInvoker::Slot>& AbstractInvoker::slot(int type, const std::thread::id& th)
+{
+    //! NOTE Expects the epoch to be pinned
+    const Slots* slots = m_slots.load(std::memory_order_acquire);
+    if (slots) {
+        for (const std::shared_ptr<Slot>& s : *slots) {
+            if (s->type == type && s->threadID == th) {
+                return s;
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_slotsMutex);
+    slots = m_slots.load(std::memory_order_acquire);
+    if (slots) {
+        for (const std::shared_ptr<Slot>& s : *slots) {
+            if (s->type == type && s->threadID == th) {
+                return s;
+            }
+        }
+    }
+
+    Slots* copy = slots ? new Slots(*slots) : new Slots();
+    copy->push_back(std::make_shared<Slot>(type, th));
+    m_slots.store(copy, std::memory_order_release);
+    if (slots) {
+        Epoch::instance()->retire(const_cast<Slots*>(slots));
+    }
+    return copy->back();
 }
 
-void AbstractInvoker::invokeCallback(int type, const CallBack& c, const NotifyData& data)
+void AbstractInvoker::postConflated(int type, QInvoker* qi)
 {
-    assert(c.threadID == std::this_thread::get_id());
+    const std::shared_ptr<Slot>& s = slot(type, qi->threadID);
 
-    if (!containsReceiver(c.receiver)) {
+    //! NOTE The pending delivery (if any) takes the latest one
+    QInvoker* old = s->pending.exchange(qi, std::memory_order_acq_rel);
+    if (old) {
+        delete old;
         return;
     }
 
-    if (c.receiver && !c.receiver->isConnectedAsync()) {
+    std::shared_ptr<Slot> keep = s;
+    QueuedInvoker::instance()->invoke(qi->threadID, [keep]() {
+        QInvoker* latest = keep->pending.exchange(nullptr, std::memory_order_acq_rel);
+        if (latest) {
+            latest->invoke();
+            delete latest;
+        }
+    }, false, priority());
+}
+
+void AbstractInvoker::invokeCallback(const CallBack& c, const NotifyData& data)
+{
+    assert(c.threadID == std::this_thread::get_id() || c.threadID == DIRECT);
+
+    //! NOTE The call is cancelled when it is unsubscribed (also by a previous callback),
+    //! when the receiver is disconnected or the invoker is destroyed
+    if (c.call->isCancelled()) {
         return;
     }
 
-    doInvoke(type, c.call, data);
+    c.call->call(data);
+}
+
+void AbstractInvoker::registerThread()
+{
+    QueuedInvoker::instance()->registerThread();
 }
 
 void AbstractInvoker::processEvents()
@@ -95,15 +285,65 @@ void AbstractInvoker::processEvents()
     QueuedInvoker::instance()->processEvents();
 }
 
+size_t AbstractInvoker::processEvents(size_t maxItems)
+{
+    return QueuedInvoker::instance()->processEvents(maxItems);
+}
+
+size_t AbstractInvoker::processEvents(const std::chrono::microseconds& budget)
+{
+    return QueuedInvoker::instance()->processEvents(budget);
+}
+
+void AbstractInvoker::waitAndProcessEvents()
+{
+    QueuedInvoker::instance()->waitAndProcessEvents();
+}
+
+void AbstractInvoker::waitAndProcessEvents(const std::chrono::microseconds& timeout)
+{
+    QueuedInvoker::instance()->waitAndProcessEvents(timeout);
+}
+
+void AbstractInvoker::runLoop()
+{
+    QueuedInvoker::instance()->runLoop();
+}
+
+void AbstractInvoker::exitLoop(const std::thread::id& th)
+{
+    QueuedInvoker::instance()->exitLoop(th);
+}
+
 void AbstractInvoker::onMainThreadInvoke(const std::function<void(const std::function<void()>&, bool)>& f)
 {
     QueuedInvoker::instance()->onMainThreadInvoke(f);
 }
 
+void AbstractInvoker::setNotifier(const std::function<void()>& f)
+{
+    QueuedInvoker::instance()->setNotifier(f);
+}
+
+int AbstractInvoker::eventFd()
+{
+    return QueuedInvoker::instance()->eventFd();
+}
+
+std::chrono::microseconds AbstractInvoker::nextTimerTimeout()
+{
+    return QueuedInvoker::instance()->nextTimerTimeout();
+}
+
 bool AbstractInvoker::isConnected() const
 {
-    for (auto it = m_callbacks.cbegin(); it != m_callbacks.cend(); ++it) {
-        const CallBacks& cs = it->second;
+    Epoch::Guard guard;
+    const CallBacksTable* map = loadCallbacks();
+    if (!map) {
+        return false;
+    }
+
+    for (const CallBacks& cs : *map) {
         if (cs.size() > 0) {
             return true;
         }
@@ -111,10 +351,30 @@ bool AbstractInvoker::isConnected() const
     return false;
 }
 
+uint64_t AbstractInvoker::deliveryCount() const
+{
+#ifdef KORS_ASYNC_STATS
+    return m_deliveries.load(std::memory_order_relaxed);
+#else
+    return 0;
+#endif
+}
+
+bool AbstractInvoker::hasCallBacks(int type) const
+{
+    Epoch::Guard guard;
+    const CallBacksTable* map = loadCallbacks();
+    if (!map) {
+        return false;
+    }
+
+    return map->find(type) != nullptr;
+}
+
 int AbstractInvoker::CallBacks::receiverIndexOf(Asyncable* receiver) const
 {
     for (size_t i = 0; i < size(); ++i) {
-        if (at(i).receiver == receiver) {
+        if (at(i).receiver == receiver && !at(i).anonymous) {
             return int(i);
         }
     }
@@ -126,106 +386,171 @@ bool AbstractInvoker::CallBacks::containsReceiver(Asyncable* receiver) const
     return receiverIndexOf(receiver) > -1;
 }
 
+void AbstractInvoker::releaseCall(ICall* call)
+{
+    //! NOTE The call is cancelled right away, but the reference of the subscription is released
+    //! only when no one can read it from an old snapshot (and take a reference)
+    call->cancel();
+    Epoch::instance()->retire(call, [](void* p) { static_cast<ICall*>(p)->release(); });
+}
+
 void AbstractInvoker::removeCallBack(int type, Asyncable* receiver)
 {
-    auto it = m_callbacks.find(type);
-    if (it == m_callbacks.end()) {
-        return;
+    ICall* call = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        call = doRemoveCallBack(type, receiver);
+    }
+
+    if (call) {
+        releaseCall(call);
+    }
+}
+
+AbstractInvoker::ICall* AbstractInvoker::doRemoveCallBack(int type, Asyncable* receiver)
+{
+    const CallBacksTable* map = loadCallbacks();
+    if (!map) {
+        return nullptr;
+    }
+
+    const CallBacks* found = map->find(type);
+    if (!found) {
+        return nullptr;
     }
 
-    CallBacks& callbacks = it->second;
-    int index = callbacks.receiverIndexOf(receiver);
+    int index = found->receiverIndexOf(receiver);
     if (index < 0) {
-        return;
+        return nullptr;
     }
 
-    CallBack c = callbacks.at(index);
+    CallBack c = found->at(index);
+
+    CallBacksTable* copy = new CallBacksTable(*map);
+    CallBacks& callbacks = copy->of(type);
+    callbacks.erase(callbacks.begin() + index);
+    setCallbacks(copy);
+
     if (c.receiver) {
         c.receiver->disconnectAsync(this);
     }
-    callbacks.erase(callbacks.begin() + index);
 
+    return c.call;
+}
+
+void AbstractInvoker::removeAllCallBacks()
+{
+    CallBacksTable removed;
     {
-        std::lock_guard<std::mutex> lock(m_qInvokersMutex);
-        for (QInvoker* qi : m_qInvokers) {
-            if (qi->call.call == c.call) {
-                qi->invalidate();
-                break;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const CallBacksTable* map = loadCallbacks();
+        if (!map) {
+            return;
+        }
+
+        removed = *map;
+        setCallbacks(nullptr);
+
+        for (const CallBacks& cs : removed) {
+            for (const CallBack& c : cs) {
+                if (c.receiver) {
+                    c.receiver->disconnectAsync(this);
+                }
             }
         }
     }
 
-    deleteCall(type, c.call);
+    for (const CallBacks& cs : removed) {
+        for (const CallBack& c : cs) {
+            releaseCall(c.call);
+        }
+    }
 }
 
-void AbstractInvoker::removeAllCallBacks()
+void AbstractInvoker::addCallBack(int type, Asyncable* receiver, ICall* call, Asyncable::AsyncMode mode, bool direct,
+                                  bool anonymous)
 {
-    for (auto it = m_callbacks.begin(); it != m_callbacks.end(); ++it) {
-        for (CallBack& c : it->second) {
-            if (c.receiver) {
-                c.receiver->disconnectAsync(this);
+    ICall* removed = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const CallBacksTable* map = loadCallbacks();
+        if (map) {
+            const CallBacks* found = map->find(type);
+            if (!anonymous && found && found->containsReceiver(receiver)) {
+                switch (mode) {
+                case Asyncable::AsyncMode::AsyncSetOnce:
+                    //! NOTE Was never visible to anyone
+                    call->release();
+                    return;
+                case Asyncable::AsyncMode::AsyncSetRepeat:
+                    removed = doRemoveCallBack(type, receiver);
+                    map = loadCallbacks();
+                    break;
+                }
             }
+        }
 
-            deleteCall(c.type, c.call);
+        //! NOTE The calls for the receiver are queued to this thread
+        if (!direct) {
+            QueuedInvoker::instance()->registerThread();
         }
-    }
-    m_callbacks.clear();
-}
 
-void AbstractInvoker::addCallBack(int type, Asyncable* receiver, void* call, Asyncable::AsyncMode mode)
-{
-    const CallBacks& callbacks = m_callbacks[type];
-    if (callbacks.containsReceiver(receiver)) {
-        switch (mode) {
-        case Asyncable::AsyncMode::AsyncSetOnce:
-            deleteCall(type, call);
-            return;
-        case Asyncable::AsyncMode::AsyncSetRepeat:
-            removeCallBack(type, receiver);
-            break;
+        CallBack c(direct ? DIRECT : std::this_thread::get_id(), type, receiver, call, anonymous);
+        CallBacksTable* copy = map ? new CallBacksTable(*map) : new CallBacksTable();
+        copy->of(type).push_back(c);
+        setCallbacks(copy);
+
+        if (c.receiver) {
+            c.receiver->connectAsync(this);
         }
     }
 
-    CallBack c(std::this_thread::get_id(), type, receiver, call);
-    m_callbacks[type].push_back(c);
-
-    if (c.receiver) {
-        c.receiver->connectAsync(this);
+    if (removed) {
+        releaseCall(removed);
     }
 }
 
 void AbstractInvoker::disconnectAsync(Asyncable* receiver)
 {
-    std::vector<int> types;
-    for (auto it = m_callbacks.begin(); it != m_callbacks.end(); ++it) {
-        for (CallBack& c : it->second) {
-            if (c.receiver == receiver) {
-                types.push_back(c.type);
+    std::vector<ICall*> removed;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const CallBacksTable* map = loadCallbacks();
+        if (!map) {
+            return;
+        }
+
+        std::vector<int> types;
+        for (const CallBacks& cs : *map) {
+            for (const CallBack& c : cs) {
+                if (c.receiver == receiver) {
+                    types.push_back(c.type);
+                }
             }
         }
-    }
 
-    for (int type : types) {
-        removeCallBack(type, receiver);
+        for (int type : types) {
+            if (ICall* call = doRemoveCallBack(type, receiver)) {
+                removed.push_back(call);
+            }
+        }
     }
-}
-
-void AbstractInvoker::addQInvoker(QInvoker* qi)
-{
-    std::lock_guard<std::mutex> lock(m_qInvokersMutex);
-    m_qInvokers.push_back(qi);
-}
 
-void AbstractInvoker::removeQInvoker(QInvoker* qi)
-{
-    std::lock_guard<std::mutex> lock(m_qInvokersMutex);
-    m_qInvokers.remove(qi);
+    for (ICall* call : removed) {
+        releaseCall(call);
+    }
 }
 
 bool AbstractInvoker::containsReceiver(Asyncable* receiver) const
 {
-    for (auto it = m_callbacks.begin(); it != m_callbacks.end(); ++it) {
-        for (const CallBack& c : it->second) {
+    Epoch::Guard guard;
+    const CallBacksTable* map = loadCallbacks();
+    if (!map) {
+        return false;
+    }
+
+    for (const CallBacks& cs : *map) {
+        for (const CallBack& c : cs) {
             if (c.receiver == receiver) {
                 return true;
             }
@@ -24,96 +24,307 @@ SOFTWARE.
 #ifndef KORS_ASYNC_ABSTRACTINVOKER_H
 #define KORS_ASYNC_ABSTRACTINVOKER_H
 
+#include <atomic>
+#include <cassert>
+#include <cstddef>
 #include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
-#include <list>
 #include <iostream>
 #include <map>
 #include <mutex>
 #include <thread>
 #include <functional>
+#include <chrono>
 
 #include "../asyncable.h"
+#include "epoch.h"
+#include "pool.h"
+#include "priority.h"
+#include "stats.h"
 
 namespace kors::async {
+//! NOTE Holds the arguments of one notification as a single `std::tuple<T...>`.
+//! Small tuples are stored inline, so no heap allocation and no refcount are needed,
+//! larger ones (or ones that can throw on move) are stored on the heap.
 class NotifyData
 {
 public:
     NotifyData() = default;
 
+    //! NOTE The `movable` flag is not copied, it is set only by the owner of the data
+    NotifyData(const NotifyData& d)
+    {
+        if (d.m_ops) {
+            d.m_ops->copy(d, *this);
+        }
+    }
+
+    NotifyData(NotifyData&& d) noexcept
+    {
+        if (d.m_ops) {
+            d.m_ops->move(d, *this);
+        }
+    }
+
+    ~NotifyData()
+    {
+        reset();
+    }
+
+    NotifyData& operator=(const NotifyData& d)
+    {
+        if (this != &d) {
+            reset();
+            if (d.m_ops) {
+                d.m_ops->copy(d, *this);
+            }
+        }
+        return *this;
+    }
+
+    NotifyData& operator=(NotifyData&& d) noexcept
+    {
+        if (this != &d) {
+            reset();
+            if (d.m_ops) {
+                d.m_ops->move(d, *this);
+            }
+        }
+        return *this;
+    }
+
+    template<typename ... T, typename ... V>
+    void setArgs(V&&... val)
+    {
+        reset();
+        Model<std::tuple<T...> >::construct(*this, std::forward<V>(val)...);
+    }
+
     template<typename ... T>
-    void setArg(int i, const T&... val)
+    const std::tuple<T...>& args() const
     {
-        IArg* p = new Arg<T...>(val ...);
-        m_args.insert(m_args.begin() + i, std::shared_ptr<IArg>(p));
+        assert(m_ops == &Model<std::tuple<T...> >::ops);
+        return *static_cast<const std::tuple<T...>*>(m_ptr);
     }
 
-    template<typename T>
-    T arg(int i = 0) const
+    //! NOTE Calls `f` with the arguments, they are moved into `f` if the data is movable
+    //! (i.e. this is the last receiver of the data). Otherwise `f` gets them by const reference,
+    //! or a copy of them, if it takes them by a non-const reference (as before the movable data)
+    template<typename ... T, typename F>
+    void apply(F&& f) const
     {
-        IArg* p = m_args.at(i).get();
-        if (!p) {
-            return {};
+        assert(m_ops == &Model<std::tuple<T...> >::ops);
+        std::tuple<T...>* args = static_cast<std::tuple<T...>*>(m_ptr);
+        if constexpr (std::is_invocable_v<F, T&&...>) {
+            if (m_movable) {
+                std::apply(std::forward<F>(f), std::move(*args));
+                return;
+            }
+        }
+
+        if constexpr (std::is_invocable_v<F, const T&...>) {
+            std::apply(std::forward<F>(f), std::as_const(*args));
+        } else if constexpr (std::is_invocable_v<F, T&&...>) {
+            std::apply(std::forward<F>(f), std::tuple<T...>(*args));
+        } else {
+            std::tuple<T...> copy(*args);
+            std::apply(std::forward<F>(f), copy);
         }
-        Arg<T>* d = reinterpret_cast<Arg<T>*>(p);
-        return std::get<0>(d->val);
     }
 
     template<typename ... T>
-    std::tuple<T...> args(int i = 0) const
+    bool holds() const
+    {
+        return m_ops == &Model<std::tuple<T...> >::ops;
+    }
+
+    bool empty() const
+    {
+        return m_ops == nullptr;
+    }
+
+    void setMovable(bool movable)
+    {
+        m_movable = movable;
+    }
+
+    void reset()
     {
-        IArg* p = m_args.at(i).get();
-        if (!p) {
-            return {};
+        if (m_ops) {
+            m_ops->destroy(*this);
+            m_ops = nullptr;
+            m_ptr = nullptr;
         }
-        Arg<T...>* d = reinterpret_cast<Arg<T...>*>(p);
-        return d->val;
+        m_movable = false;
     }
 
-    struct IArg {
-        virtual ~IArg() = default;
+private:
+
+    static constexpr size_t INLINE_SIZE = 48;
+
+    struct Ops {
+        void (*copy)(const NotifyData& from, NotifyData& to);
+        void (*move)(NotifyData& from, NotifyData& to);
+        void (*destroy)(NotifyData& d);
     };
 
-    template<typename ... T>
-    struct Arg : public IArg {
-        std::tuple<T...> val;
-        Arg(const T&... v)
-            : IArg(), val(v ...) {}
+    template<typename Args>
+    struct Model {
+        static constexpr bool isInline = sizeof(Args) <= INLINE_SIZE
+                                         && alignof(Args) <= alignof(std::max_align_t)
+                                         && std::is_nothrow_move_constructible_v<Args>;
+
+        template<typename ... V>
+        static void construct(NotifyData& d, V&&... val)
+        {
+            if constexpr (isInline) {
+                d.m_ptr = new (&d.m_buf) Args(std::forward<V>(val)...);
+            } else {
+                d.m_ptr = new Args(std::forward<V>(val)...);
+            }
+            d.m_ops = &ops;
+        }
+
+        static void copy(const NotifyData& from, NotifyData& to)
+        {
+            construct(to, *static_cast<const Args*>(from.m_ptr));
+        }
+
+        static void move(NotifyData& from, NotifyData& to)
+        {
+            if constexpr (isInline) {
+                construct(to, std::move(*static_cast<Args*>(from.m_ptr)));
+                from.reset();
+            } else {
+                to.m_ptr = from.m_ptr;
+                to.m_ops = from.m_ops;
+                from.m_ptr = nullptr;
+                from.m_ops = nullptr;
+            }
+        }
+
+        static void destroy(NotifyData& d)
+        {
+            if constexpr (isInline) {
+                static_cast<Args*>(d.m_ptr)->~Args();
+            } else {
+                delete static_cast<Args*>(d.m_ptr);
+            }
+        }
+
+        static constexpr Ops ops = { &Model::copy, &Model::move, &Model::destroy };
     };
 
-private:
-    std::vector<std::shared_ptr<IArg> > m_args;
+    const Ops* m_ops = nullptr;
+    void* m_ptr = nullptr;
+    bool m_movable = false;
+    alignas(std::max_align_t) unsigned char m_buf[INLINE_SIZE];
+};
+
+//! NOTE The arguments as one value: `T` for a single argument, otherwise `std::tuple<T...>`
+template<typename ... T>
+struct ValueOf {
+    using type = std::tuple<T...>;
+};
+
+template<typename T>
+struct ValueOf<T> {
+    using type = T;
 };
 
 class QueuedInvoker;
 class AbstractInvoker : public Asyncable::IConnectable
 {
 public:
+    //! NOTE Base of the subscribed calls.
+    //! A call is shared (refcounted) by the subscription and by its queued deliveries,
+    //! removing the subscription cancels all pending deliveries of the call at once.
+    struct ICall : public Pooled {
+        virtual ~ICall() = default;
+        virtual void call(const NotifyData& d) = 0;
+
+        void addRef()
+        {
+            m_refs.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void release()
+        {
+            if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete this;
+            }
+        }
+
+        void cancel()
+        {
+            m_cancelled.store(true, std::memory_order_release);
+        }
+
+        bool isCancelled() const
+        {
+            return m_cancelled.load(std::memory_order_acquire);
+        }
+
+    private:
+        std::atomic<int> m_refs = 1;
+        std::atomic<bool> m_cancelled = false;
+    };
+
     void disconnectAsync(Asyncable* receiver);
 
     void invoke(int type);
     void invoke(int type, const NotifyData& data);
+    void invoke(int type, NotifyData&& data);
 
     bool isConnected() const;
 
+    //! NOTE The number of the receivers the notifications were sent to, counted only with KORS_ASYNC_STATS
+    uint64_t deliveryCount() const;
+
+    //! NOTE Invokers are created by `make`. When the last owner releases the invoker, its callbacks are removed
+    //! right away, but the invoker is deleted through Epoch: a receiver which is destroyed at the same time
+    //! on another thread may have already taken its connection out (see Asyncable::disconnectAll)
+    //! and still call `disconnectAsync` of the invoker
+    template<typename T, typename ... Args>
+    static std::shared_ptr<T> make(Args&&... args)
+    {
+        return std::shared_ptr<T>(new T(std::forward<Args>(args)...), [](T* p) {
+            static_cast<AbstractInvoker*>(p)->removeAllCallBacks();
+            Epoch::instance()->retire(p);
+        }, PoolAllocator<T>());
+    }
+
+    static void registerThread();
     static void processEvents();
+    static size_t processEvents(size_t maxItems);
+    static size_t processEvents(const std::chrono::microseconds& budget);
+    static void waitAndProcessEvents();
+    static void waitAndProcessEvents(const std::chrono::microseconds& timeout);
+    static void runLoop();
+    static void exitLoop(const std::thread::id& th);
     static void onMainThreadInvoke(const std::function<void(const std::function<void()>&, bool)>& f);
+    static void setNotifier(const std::function<void()>& f);
+    static int eventFd();
+    static std::chrono::microseconds nextTimerTimeout();
 
 protected:
     explicit AbstractInvoker();
     ~AbstractInvoker();
 
-    virtual void deleteCall(int type, void* call) = 0;
-    virtual void doInvoke(int type, void* call, const NotifyData& data) = 0;
-
     struct CallBack {
         std::thread::id threadID;
         int type = 0;
         Asyncable* receiver = nullptr;
-        void* call = nullptr;
+        ICall* call = nullptr;
+        //! NOTE Not replaced by another subscription (and not removed) by its receiver, see addCallBack
+        bool anonymous = false;
         CallBack() = default;
-        CallBack(std::thread::id threadID, int t, Asyncable* cr, void* c)
-            : threadID(threadID), type(t), receiver(cr), call(c) {}
+        CallBack(std::thread::id threadID, int t, Asyncable* cr, ICall* c, bool a = false)
+            : threadID(threadID), type(t), receiver(cr), call(c), anonymous(a) {}
     };
 
     class CallBacks : public std::vector<CallBack>
@@ -123,62 +334,230 @@ protected:
         bool containsReceiver(Asyncable* receiver) const;
     };
 
-    struct QInvoker
-    {
-        std::mutex mutex;
-        AbstractInvoker* invoker = nullptr;
-        int type = -1;
-        CallBack call;
+    //! NOTE Data shared by several destination threads (and the sending thread),
+    //! `readers` is the number of batches (and senders) which have not finished with it yet
+    struct SharedData {
         NotifyData data;
+        std::atomic<int> readers = 0;
+    };
+
+    //! NOTE One queued delivery per destination thread,
+    //! delivers the data to all receivers of this thread in order.
+    //! The data is owned by the batch if it is the only one destination,
+    //! otherwise it is shared (immutable) between the batches of all destination threads.
+    //! The batch holds a reference to each call, so it doesn't need the invoker
+    //! and is not affected by its destruction, cancelled calls are just skipped.
+    struct QInvoker : public Pooled
+    {
+        std::thread::id threadID;
+        std::vector<CallBack, PoolAllocator<CallBack> > calls;
+        NotifyData ownData;
+        std::shared_ptr<SharedData> sharedData;
 
-        QInvoker(AbstractInvoker* i, int t, CallBack c, NotifyData d)
-            : invoker(i), type(t), call(c), data(d)
+        //! NOTE The owner of an invoker, whose subscriptions must not be cancelled before the delivery (see Promise)
+        std::shared_ptr<void> keepAlive;
+
+        explicit QInvoker(const std::thread::id& th)
+            : threadID(th)
         {
-            invoker->addQInvoker(this);
+#ifdef KORS_ASYNC_STATS
+            Stats::add(&Stats::Counters::batches, 1);
+#endif
         }
 
         ~QInvoker()
         {
-            if (invoker) {
-                invoker->removeQInvoker(this);
+#ifdef KORS_ASYNC_STATS
+            Stats::add(&Stats::Counters::batches, -1);
+#endif
+            for (const CallBack& c : calls) {
+                c.call->release();
+            }
+
+            if (sharedData) {
+                sharedData->readers.fetch_sub(1, std::memory_order_release);
             }
         }
 
+        void add(const CallBack& c)
+        {
+            c.call->addRef();
+            calls.push_back(c);
+        }
+
         void invoke()
         {
-            AbstractInvoker* inv = nullptr;
-            {
-                std::lock_guard<std::mutex> lock(mutex);
-                inv = invoker;
+            NotifyData& data = sharedData ? sharedData->data : ownData;
+            for (size_t i = 0; i < calls.size(); ++i) {
+                const CallBack& c = calls.at(i);
+                if (i == calls.size() - 1 && isLastOwner()) {
+                    data.setMovable(true);
+                }
+
+                invokeCallback(c, data);
+            }
+        }
+
+        bool isLastOwner() const
+        {
+            //! NOTE Acquire - synchronize with the other readers which have already finished
+            return !sharedData || sharedData->readers.load(std::memory_order_acquire) == 1;
+        }
+    };
+
+    //! NOTE The calls of the receivers of the sending thread, taken from a snapshot under Epoch::Guard
+    //! and called after it is left, so a slow (or blocking) receiver doesn't keep the epoch pinned.
+    //! Each call is held by a reference, a cancelled one is skipped
+    class LocalCalls
+    {
+    public:
+        LocalCalls() = default;
+        LocalCalls(const LocalCalls&) = delete;
+        LocalCalls& operator=(const LocalCalls&) = delete;
+
+        ~LocalCalls()
+        {
+            for (size_t i = 0; i < m_count; ++i) {
+                at(i)->release();
             }
+        }
 
-            if (inv) {
-                inv->invokeCallback(type, call, data);
+        void add(ICall* call)
+        {
+            call->addRef();
+            if (m_count < INLINE_COUNT) {
+                m_inline[m_count] = call;
+            } else {
+                m_more.push_back(call);
             }
+            ++m_count;
         }
 
-        void invalidate()
+        bool empty() const
         {
-            std::lock_guard<std::mutex> lock(mutex);
-            invoker = nullptr;
+            return m_count == 0;
+        }
+
+        //! NOTE The last one gets `data` movable, if `movable`
+        void call(const NotifyData& data, NotifyData* movable = nullptr)
+        {
+            for (size_t i = 0; i < m_count; ++i) {
+                if (movable && i == m_count - 1) {
+                    movable->setMovable(true);
+                }
+
+                ICall* c = at(i);
+                if (!c->isCancelled()) {
+                    c->call(data);
+                }
+            }
+        }
+
+    private:
+        static constexpr size_t INLINE_COUNT = 4;
+
+        ICall* at(size_t i) const
+        {
+            return i < INLINE_COUNT ? m_inline[i] : m_more[i - INLINE_COUNT];
+        }
+
+        ICall* m_inline[INLINE_COUNT];
+        std::vector<ICall*> m_more;
+        size_t m_count = 0;
+    };
+
+    //! NOTE Only the latest not yet delivered notification of the type is kept per receiver thread,
+    //! a new one replaces the pending one, so the receiver thread gets at most one per processing
+    void setConflated(int type, bool conflated);
+    bool isConflated(int type) const;
+
+    //! NOTE The lane of the receiver thread queues which the notifications are posted to
+    void setPriority(Priority priority);
+    Priority priority() const;
+
+    struct Slot {
+        std::atomic<QInvoker*> pending = nullptr;
+        int type = 0;
+        std::thread::id threadID;
+
+        Slot(int t, const std::thread::id& th)
+            : type(t), threadID(th) {}
+
+        ~Slot()
+        {
+            delete pending.load(std::memory_order_acquire);
         }
     };
 
-    void invokeCallback(int type, const CallBack& c, const NotifyData& data);
+    using Slots = std::vector<std::shared_ptr<Slot> >;
+
+    const std::shared_ptr<Slot>& slot(int type, const std::thread::id& th);
+    void postConflated(int type, QInvoker* qi);
+
+    //! NOTE The queued deliveries hold `keepAlive` until they are delivered
+    void invoke(int type, const NotifyData& data, const std::shared_ptr<void>& keepAlive);
+    void invoke(int type, const NotifyData& data, NotifyData* ownedData, const std::shared_ptr<void>* keepAlive = nullptr);
+    static void invokeCallback(const CallBack& c, const NotifyData& data);
 
-    void addCallBack(int type, Asyncable* receiver, void* call, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetRepeat);
+    bool hasCallBacks(int type) const;
+
+    //! NOTE A direct callback is called on the sending thread, right in `invoke` (see Selector).
+    //! An anonymous one has no receiver and stacks with the others (the continuations of Promise)
+    void addCallBack(int type, Asyncable* receiver, ICall* call, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetRepeat,
+                     bool direct = false, bool anonymous = false);
     void removeCallBack(int type, Asyncable* receiver);
     void removeAllCallBacks();
 
-    void addQInvoker(QInvoker* qi);
-    void removeQInvoker(QInvoker* qi);
+    ICall* doRemoveCallBack(int type, Asyncable* receiver);
+    static void releaseCall(ICall* call);
 
     bool containsReceiver(Asyncable* receiver) const;
 
-    std::map<int /*type*/, CallBacks > m_callbacks;
+    //! NOTE The callbacks of each type, indexed by the type (the types are the small values
+    //! of the CallType enums), so a send finds its receivers without a search
+    class CallBacksTable : public std::vector<CallBacks>
+    {
+    public:
+        const CallBacks* find(int type) const
+        {
+            if (type < 0 || size_t(type) >= size() || at(type).empty()) {
+                return nullptr;
+            }
+            return &at(type);
+        }
+
+        CallBacks& of(int type)
+        {
+            assert(type >= 0);
+            if (size_t(type) >= size()) {
+                resize(type + 1);
+            }
+            return at(type);
+        }
+    };
+
+    //! NOTE Immutable snapshot of the callbacks, it is replaced (copy-on-write) on subscribe/unsubscribe,
+    //! the old one is deleted when no one reads it anymore (see Epoch)
+    const CallBacksTable* loadCallbacks() const;
+    void setCallbacks(const CallBacksTable* callbacks);
+
+    std::atomic<const CallBacksTable*> m_callbacks = nullptr;
+
+    //! NOTE Serializes only the modifications of this invoker, sends don't take it
+    std::mutex m_mutex;
+
+    //! NOTE Bit per conflated type
+    std::atomic<uint32_t> m_conflated = 0;
+
+    std::atomic<Priority> m_priority = Priority::Normal;
+
+#ifdef KORS_ASYNC_STATS
+    std::atomic<uint64_t> m_deliveries = 0;
+#endif
 
-    std::mutex m_qInvokersMutex;
-    std::list<QInvoker*> m_qInvokers;
+    //! NOTE Copy-on-write, like the callbacks, new slots are added rarely (a new receiver thread)
+    std::atomic<const Slots*> m_slots = nullptr;
+    std::mutex m_slotsMutex;
 };
 }
 
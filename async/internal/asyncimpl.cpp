@@ -23,7 +23,11 @@ SOFTWARE.
 */
 #include "asyncimpl.h"
 
+#include <algorithm>
+#include <vector>
+
 #include "queuedinvoker.h"
+#include "threadpool.h"
 
 using namespace kors::async;
 
@@ -35,58 +39,188 @@ AsyncImpl* AsyncImpl::instance()
 
 void AsyncImpl::disconnectAsync(Asyncable* caller)
 {
-    std::lock_guard locker(m_mutex);
-    uint64_t key = 0;
-    std::map<uint64_t, Call>::const_iterator it = m_calls.cbegin(), end = m_calls.cend();
-    for (; it != end; ++it) {
-        if (it->second.caller == caller) {
-            key = it->first;
-            break;
+    Tracker* t = caller->callsTracker<Tracker>(false);
+    if (t) {
+        t->disconnectAsync(caller);
+        t->release();
+    }
+}
+
+void AsyncImpl::call(Asyncable* caller, IFunction* f, const std::thread::id& th, Priority priority)
+{
+    Tracker* t = track(caller, f);
+    auto functor = [t, f]() { onCall(t, f); };
+    QueuedInvoker::instance()->invoke(th, functor, true, priority);
+}
+
+void AsyncImpl::call(Asyncable* caller, IFunction* f, ThreadPool* pool)
+{
+    Tracker* t = track(caller, f);
+    pool->post([t, f]() { onCall(t, f); });
+}
+
+void AsyncImpl::callAfter(Asyncable* caller, IFunction* f, const std::chrono::microseconds& delay, const std::thread::id& th)
+{
+    //! NOTE The id is set before the call is tracked, the tracker reads it when the caller is disconnected
+    QueuedInvoker* qi = QueuedInvoker::instance();
+    f->timerID = qi->newTimerID();
+    f->timerThread = th;
+    Tracker* t = track(caller, f);
+    qi->invokeAfter(th, delay, std::chrono::microseconds(0), [t, f]() {
+        onCall(t, f);
+        return false;
+    }, f->timerID);
+}
+
+void AsyncImpl::callEvery(Asyncable* caller, IRepeatFunction* f, const std::chrono::microseconds& interval, const std::thread::id& th)
+{
+    QueuedInvoker* qi = QueuedInvoker::instance();
+    f->timerID = qi->newTimerID();
+    f->timerThread = th;
+    Tracker* t = track(caller, f);
+    qi->invokeAfter(th, interval, interval, [t, f]() {
+        return onRepeat(t, f);
+    }, f->timerID);
+}
+
+AsyncImpl::Tracker* AsyncImpl::track(Asyncable* caller, IFunction* f)
+{
+    if (!caller) {
+        return nullptr;
+    }
+
+    Tracker* t = caller->callsTracker<Tracker>();
+    t->add(f);
+    return t;
+}
+
+void AsyncImpl::onCall(Tracker* t, IFunction* f)
+{
+    if (t) {
+        bool taken = t->take(f);
+        t->release();
+
+        //! NOTE Probably disconnected
+        if (!taken) {
+            delete f;
+            return;
+        }
+    }
+
+    f->call();
+
+    delete f;
+}
+
+bool AsyncImpl::onRepeat(Tracker* t, IRepeatFunction* f)
+{
+    //! NOTE The timer stays registered in the tracker until it is finished
+    if (!t || !t->isCancelled(f)) {
+        f->call();
+        if (!f->finished) {
+            return true;
         }
     }
 
-    if (key) {
-        m_calls.erase(key);
+    if (t) {
+        t->take(f);
+        t->release();
     }
+
+    delete f;
+    return false;
 }
 
-void AsyncImpl::call(Asyncable* caller, IFunction* f, const std::thread::id& th)
+void AsyncImpl::Tracker::addRef()
 {
-    if (caller) {
-        caller->connectAsync(this);
+    m_refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AsyncImpl::Tracker::release()
+{
+    if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete this;
     }
+}
 
-    uint64_t key = reinterpret_cast<uint64_t>(f);
-    {
-        std::lock_guard locker(m_mutex);
-        m_calls[key] = Call(caller, f);
+bool AsyncImpl::Tracker::add(IFunction* f)
+{
+    std::lock_guard locker(m_mutex);
+    if (!m_connected) {
+        f->cancelled = true;
+        return false;
+    }
+
+    f->next = m_head;
+    if (m_head) {
+        m_head->prev = f;
+    }
+    m_head = f;
+    return true;
+}
+
+bool AsyncImpl::Tracker::take(IFunction* f)
+{
+    std::lock_guard locker(m_mutex);
+    if (f->cancelled) {
+        return false;
     }
 
-    auto functor = [this, key]() { onCall(key); };
-    QueuedInvoker::instance()->invoke(th, functor, true);
+    if (f->prev) {
+        f->prev->next = f->next;
+    } else {
+        m_head = f->next;
+    }
+    if (f->next) {
+        f->next->prev = f->prev;
+    }
+    f->prev = nullptr;
+    f->next = nullptr;
+    return true;
 }
 
-void AsyncImpl::onCall(uint64_t key)
+bool AsyncImpl::Tracker::isCancelled(IFunction* f)
 {
-    Call c;
+    std::lock_guard locker(m_mutex);
+    return f->cancelled;
+}
+
+void AsyncImpl::Tracker::disconnectAsync(Asyncable* caller)
+{
+    //! NOTE The ids are copied, a cancelled call may be deleted by its thread right after the unlock
+    std::vector<std::pair<std::thread::id, uint64_t> > timers;
     {
         std::lock_guard locker(m_mutex);
-        auto it = m_calls.find(key);
-
-        //! NOTE Probably disconnected
-        if (it == m_calls.end()) {
+        if (!m_connected) {
             return;
         }
 
-        c = it->second;
-        m_calls.erase(it);
+        m_connected = false;
+        for (IFunction* f = m_head; f; f = f->next) {
+            f->cancelled = true;
+            if (f->timerID) {
+                timers.emplace_back(f->timerThread, f->timerID);
+            }
+        }
+        m_head = nullptr;
     }
 
-    c.f->call();
-
-    if (c.caller) {
-        c.caller->disconnectAsync(this);
+    caller->disconnectAsync(this);
+
+    //! NOTE The timers are removed eagerly (a long delay would keep the call and its captures),
+    //! their functors see the calls cancelled and release them
+    if (!timers.empty()) {
+        std::sort(timers.begin(), timers.end());
+        std::vector<uint64_t> ids;
+        for (size_t i = 0; i < timers.size(); ++i) {
+            ids.push_back(timers[i].second);
+            if (i + 1 == timers.size() || timers[i + 1].first != timers[i].first) {
+                QueuedInvoker::instance()->cancelTimers(timers[i].first, ids);
+                ids.clear();
+            }
+        }
     }
 
-    delete c.f;
+    //! NOTE The reference of the caller
+    release();
 }
@@ -24,21 +24,49 @@ SOFTWARE.
 #ifndef KORS_ASYNC_ASYNCIMPL_H
 #define KORS_ASYNC_ASYNCIMPL_H
 
+#include <atomic>
+#include <chrono>
 #include <mutex>
-#include <map>
+#include <type_traits>
 #include <thread>
 #include "../asyncable.h"
+#include "pool.h"
+#include "priority.h"
+#include "stats.h"
 
 namespace kors::async {
-class AsyncImpl : public Asyncable::IConnectable
+class ThreadPool;
+class AsyncImpl
 {
 public:
 
     static AsyncImpl* instance();
 
-    struct IFunction {
-        virtual ~IFunction() {}
+    struct IFunction : public Pooled {
+        IFunction()
+        {
+#ifdef KORS_ASYNC_STATS
+            Stats::add(&Stats::Counters::calls, 1);
+#endif
+        }
+
+        virtual ~IFunction()
+        {
+#ifdef KORS_ASYNC_STATS
+            Stats::add(&Stats::Counters::calls, -1);
+#endif
+        }
+
         virtual void call() = 0;
+
+        //! NOTE Links in the list of the pending calls of the caller, guarded by the tracker mutex
+        IFunction* prev = nullptr;
+        IFunction* next = nullptr;
+        bool cancelled = false;
+
+        //! NOTE The timer of a delayed call, it is removed when the caller is disconnected
+        uint64_t timerID = 0;
+        std::thread::id timerThread;
     };
 
     template<typename F>
@@ -58,24 +86,65 @@ public:
         void call() { functor(arg1); }
     };
 
-    void call(Asyncable* caller, IFunction* f, const std::thread::id& th = std::this_thread::get_id());
+    //! NOTE A repeating call, it is finished when the functor returns false (if it returns bool)
+    struct IRepeatFunction : public IFunction {
+        bool finished = false;
+    };
+
+    template<typename F>
+    struct RepeatFunctor : public IRepeatFunction {
+        F functor;
+        RepeatFunctor(const F fn)
+            : functor(fn) {}
+        void call()
+        {
+            if constexpr (std::is_same_v<decltype(functor()), bool>) {
+                finished = !functor();
+            } else {
+                functor();
+            }
+        }
+    };
+
+    void call(Asyncable* caller, IFunction* f, const std::thread::id& th = std::this_thread::get_id(),
+              Priority priority = Priority::Normal);
+    void call(Asyncable* caller, IFunction* f, ThreadPool* pool);
+    void callAfter(Asyncable* caller, IFunction* f, const std::chrono::microseconds& delay, const std::thread::id& th);
+    void callEvery(Asyncable* caller, IRepeatFunction* f, const std::chrono::microseconds& interval, const std::thread::id& th);
     void disconnectAsync(Asyncable* caller);
 
-private:
-    AsyncImpl() = default;
+    //! NOTE Pending calls of one caller (intrusive list),
+    //! it is referenced by the caller and by each pending call, so it outlives the caller if needed
+    class Tracker : public Asyncable::IConnectable
+    {
+    public:
+        void addRef();
+        void release();
+
+        //! NOTE Returns false if the caller is already disconnected (the call is cancelled)
+        bool add(IFunction* f);
+
+        //! NOTE Returns false if the call was cancelled
+        bool take(IFunction* f);
 
-    void onCall(uint64_t key);
+        bool isCancelled(IFunction* f);
 
-    struct Call {
-        Asyncable* caller = nullptr;
-        IFunction* f = nullptr;
-        Call() = default;
-        Call(Asyncable* c, IFunction* _f)
-            : caller(c), f(_f) {}
+        void disconnectAsync(Asyncable* caller) override;
+
+    private:
+        //! NOTE The reference of the caller
+        std::atomic<int> m_refs = 1;
+        std::mutex m_mutex;
+        bool m_connected = true;
+        IFunction* m_head = nullptr;
     };
 
-    std::mutex m_mutex;
-    std::map<uint64_t, Call> m_calls;
+private:
+    AsyncImpl() = default;
+
+    static Tracker* track(Asyncable* caller, IFunction* f);
+    static void onCall(Tracker* t, IFunction* f);
+    static bool onRepeat(Tracker* t, IRepeatFunction* f);
 };
 }
 
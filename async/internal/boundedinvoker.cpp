@@ -0,0 +1,290 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "boundedinvoker.h"
+
+#include "queuedinvoker.h"
+
+using namespace kors::async;
+
+BoundedInvoker::BoundedInvoker(int type, size_t capacity, OverflowPolicy overflow)
+    : m_type(type), m_capacity(capacity > 0 ? capacity : 1), m_overflow(overflow)
+{
+}
+
+BoundedInvoker::~BoundedInvoker()
+{
+    removeAllCallBacks();
+
+    const Lanes* lanes = m_lanes.exchange(nullptr, std::memory_order_acq_rel);
+    if (lanes) {
+        Epoch::instance()->retire(const_cast<Lanes*>(lanes));
+    }
+}
+
+std::shared_ptr<BoundedInvoker::Lane> BoundedInvoker::lane(const std::thread::id& th)
+{
+    const Lanes* lanes = m_lanes.load(std::memory_order_acquire);
+    if (lanes) {
+        for (const std::shared_ptr<Lane>& l : *lanes) {
+            if (l->threadID == th) {
+                return l;
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_lanesMutex);
+    lanes = m_lanes.load(std::memory_order_acquire);
+    Lanes* copy = lanes ? new Lanes(*lanes) : new Lanes();
+    for (const std::shared_ptr<Lane>& l : *copy) {
+        if (l->threadID == th) {
+            std::shared_ptr<Lane> found = l;
+            delete copy;
+            return found;
+        }
+    }
+
+    copy->push_back(std::make_shared<Lane>(th, m_capacity));
+    std::shared_ptr<Lane> l = copy->back();
+    m_lanes.store(copy, std::memory_order_release);
+    if (lanes) {
+        Epoch::instance()->retire(const_cast<Lanes*>(lanes));
+    }
+    return l;
+}
+
+bool BoundedInvoker::send(NotifyData&& data, bool tryOnly)
+{
+    std::thread::id threadID = std::this_thread::get_id();
+
+    //! NOTE Only the lanes are taken from the snapshots, the pushes may wait for a lagging consumer
+    //! and the epoch must not stay pinned for that time (nothing retired anywhere could be reclaimed)
+    std::vector<std::shared_ptr<Lane> > lanes;
+    bool hasLocal = false;
+    {
+        Epoch::Guard guard;
+        const CallBacksTable* snapshot = loadCallbacks();
+        const CallBacks* found = snapshot ? snapshot->find(m_type) : nullptr;
+        if (!found) {
+            return true;
+        }
+
+        for (const CallBack& c : *found) {
+            if (c.threadID == threadID) {
+                hasLocal = true;
+                continue;
+            }
+
+            std::shared_ptr<Lane> l = lane(c.threadID);
+            bool found = false;
+            for (const std::shared_ptr<Lane>& q : lanes) {
+                if (q == l) {
+                    found = true;
+                    break;
+                }
+            }
+
+            if (!found) {
+                lanes.push_back(std::move(l));
+            }
+        }
+    }
+
+    bool queued = true;
+    for (size_t i = 0; i < lanes.size(); ++i) {
+        //! NOTE The only one destination gets the data itself, others get a copy
+        bool isLast = i == lanes.size() - 1 && !hasLocal;
+        NotifyData copy;
+        if (!isLast) {
+            copy = data;
+        }
+
+        if (!push(lanes.at(i), isLast ? data : copy, tryOnly)) {
+            queued = false;
+        }
+    }
+
+    if (!hasLocal) {
+        return queued;
+    }
+
+    //! NOTE The callbacks could change while the pushes were waiting
+    LocalCalls local;
+    localCalls(threadID, local);
+    local.call(data, &data);
+
+    return queued;
+}
+
+void BoundedInvoker::localCalls(const std::thread::id& th, LocalCalls& calls)
+{
+    Epoch::Guard guard;
+    const CallBacksTable* snapshot = loadCallbacks();
+    const CallBacks* found = snapshot ? snapshot->find(m_type) : nullptr;
+    if (!found) {
+        return;
+    }
+
+    for (const CallBack& c : *found) {
+        if (c.threadID == th) {
+            calls.add(c.call);
+        }
+    }
+}
+
+bool BoundedInvoker::push(const std::shared_ptr<Lane>& l, NotifyData& data, bool tryOnly)
+{
+    //! NOTE The consumer takes the lock too, the producer drops the oldest value
+    if (m_overflow == OverflowPolicy::DropOldest) {
+        return pushLocked(l, data, tryOnly);
+    }
+
+    std::thread::id me = std::this_thread::get_id();
+    std::thread::id owner = l->producer.load(std::memory_order_acquire);
+    if (owner == std::thread::id()) {
+        if (l->producer.compare_exchange_strong(owner, me, std::memory_order_acq_rel)) {
+            owner = me;
+        }
+    }
+
+    if (owner == me) {
+        l->busy.store(true, std::memory_order_seq_cst);
+        if (!l->shared.load(std::memory_order_seq_cst)) {
+            bool ok = l->ring.push(data);
+            l->busy.store(false, std::memory_order_release);
+            if (ok) {
+                schedule(l);
+                return true;
+            }
+
+            if (m_overflow != OverflowPolicy::Block || tryOnly) {
+                return false;
+            }
+        } else {
+            l->busy.store(false, std::memory_order_release);
+        }
+    } else if (!l->shared.load(std::memory_order_relaxed)) {
+        //! NOTE From now on, all producers take the lock
+        l->shared.store(true, std::memory_order_seq_cst);
+    }
+
+    return pushLocked(l, data, tryOnly);
+}
+
+bool BoundedInvoker::pushLocked(const std::shared_ptr<Lane>& l, NotifyData& data, bool tryOnly)
+{
+    std::unique_lock<std::mutex> lock(l->mutex);
+
+    //! NOTE Wait for the push of the only producer (before it noticed the others)
+    while (l->busy.load(std::memory_order_seq_cst)) {
+        std::this_thread::yield();
+    }
+
+    for (;;) {
+        if (l->ring.push(data)) {
+            break;
+        }
+
+        if (tryOnly) {
+            return false;
+        }
+
+        switch (m_overflow) {
+        case OverflowPolicy::DropOldest: {
+            NotifyData oldest;
+            l->ring.pop(oldest);
+        } continue;
+        case OverflowPolicy::DropNewest:
+        case OverflowPolicy::Fail:
+            return false;
+        case OverflowPolicy::Block:
+            break;
+        }
+
+        //! NOTE Seq cst - pairs with the consumer, which checks the waiters after taking a value
+        l->waiters.fetch_add(1, std::memory_order_seq_cst);
+        l->cond.wait(lock, [&l]() { return !l->ring.full(); });
+        l->waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    lock.unlock();
+    schedule(l);
+    return true;
+}
+
+void BoundedInvoker::schedule(const std::shared_ptr<Lane>& lane)
+{
+    if (lane->scheduled.exchange(true, std::memory_order_seq_cst)) {
+        return;
+    }
+
+    std::weak_ptr<BoundedInvoker> weak = weak_from_this();
+    QueuedInvoker::instance()->invoke(lane->threadID, [weak, lane]() {
+        //! NOTE The queued values are dropped if the invoker is already destroyed
+        if (std::shared_ptr<BoundedInvoker> inv = weak.lock()) {
+            inv->drain(lane);
+        }
+    }, true);
+}
+
+void BoundedInvoker::drain(const std::shared_ptr<Lane>& l)
+{
+    assert(l->threadID == std::this_thread::get_id());
+
+    //! NOTE Cleared before taking the values, a value pushed after the last check posts a new delivery
+    l->scheduled.store(false, std::memory_order_seq_cst);
+
+    //! NOTE At most one ring of values per delivery, so a live producer can't hold the thread here
+    //! (beyond the limits of processEvents), the rest is delivered by the next one
+    bool locked = m_overflow == OverflowPolicy::DropOldest;
+    NotifyData data;
+    for (size_t n = 0;; ++n) {
+        if (n == m_capacity) {
+            schedule(l);
+            break;
+        }
+
+        bool ok = false;
+        if (locked) {
+            std::lock_guard<std::mutex> lock(l->mutex);
+            ok = l->ring.pop(data);
+        } else {
+            ok = l->ring.pop(data);
+        }
+
+        if (!ok) {
+            break;
+        }
+
+        if (l->waiters.load(std::memory_order_seq_cst) > 0) {
+            std::lock_guard<std::mutex> lock(l->mutex);
+            l->cond.notify_all();
+        }
+
+        LocalCalls local;
+        localCalls(l->threadID, local);
+        local.call(data, &data);
+
+        data.reset();
+    }
+}
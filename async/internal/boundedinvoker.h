@@ -0,0 +1,108 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef KORS_ASYNC_BOUNDEDINVOKER_H
+#define KORS_ASYNC_BOUNDEDINVOKER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "abstractinvoker.h"
+#include "ringbuffer.h"
+
+namespace kors::async {
+//! NOTE What to do when the queue of a receiver thread is full
+enum class OverflowPolicy {
+    Block,      // wait until the receiver thread takes a value
+    DropOldest, // drop the oldest queued value
+    DropNewest, // drop the value being sent
+    Fail        // don't queue the value, send returns false
+};
+
+//! NOTE Invoker with a queue of a fixed capacity per receiver thread.
+//! The values of one type are queued in the ring buffer of the receiver thread,
+//! only one delivery is posted to the thread while its queue is not empty.
+//! While there is only one producer thread, it doesn't take any lock (except to wait when it's full).
+class BoundedInvoker : public AbstractInvoker, public std::enable_shared_from_this<BoundedInvoker>
+{
+public:
+    BoundedInvoker(int type, size_t capacity, OverflowPolicy overflow);
+    ~BoundedInvoker();
+
+    //! NOTE Returns false if the data was not queued for some receiver thread (dropped or failed),
+    //! `tryOnly` - never wait, fail instead
+    bool send(NotifyData&& data, bool tryOnly);
+
+private:
+    template<typename ... T>
+    friend class BoundedChannel;
+
+    struct Lane {
+        std::thread::id threadID;
+        RingBuffer<NotifyData> ring;
+
+        //! NOTE Serializes the producers, when there is more than one (and everything for DropOldest)
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::atomic<int> waiters = 0;
+
+        //! NOTE A delivery is posted to the thread
+        std::atomic<bool> scheduled = false;
+
+        //! NOTE The only producer pushes without the lock while `shared` is not set,
+        //! `busy` is set for the time of such a push
+        std::atomic<std::thread::id> producer;
+        std::atomic<bool> shared = false;
+        std::atomic<bool> busy = false;
+
+        Lane(const std::thread::id& th, size_t capacity)
+            : threadID(th), ring(capacity) {}
+    };
+
+    using Lanes = std::vector<std::shared_ptr<Lane> >;
+
+    //! NOTE Under Epoch::Guard (reads the lanes snapshot), the lane is held by the returned pointer
+    std::shared_ptr<Lane> lane(const std::thread::id& th);
+    bool push(const std::shared_ptr<Lane>& l, NotifyData& data, bool tryOnly);
+    bool pushLocked(const std::shared_ptr<Lane>& l, NotifyData& data, bool tryOnly);
+    void schedule(const std::shared_ptr<Lane>& l);
+    void drain(const std::shared_ptr<Lane>& l);
+
+    //! NOTE The calls of the receivers of the thread `th`, to be called out of the guard
+    void localCalls(const std::thread::id& th, LocalCalls& calls);
+
+    int m_type = 0;
+    size_t m_capacity = 0;
+    OverflowPolicy m_overflow = OverflowPolicy::Block;
+
+    //! NOTE Copy-on-write, like the callbacks, new lanes are added rarely (a new receiver thread)
+    std::atomic<const Lanes*> m_lanes = nullptr;
+    std::mutex m_lanesMutex;
+};
+}
+
+#endif // KORS_ASYNC_BOUNDEDINVOKER_H
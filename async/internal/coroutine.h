@@ -0,0 +1,59 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef KORS_ASYNC_COROUTINE_H
+#define KORS_ASYNC_COROUTINE_H
+
+//! NOTE C++20 coroutines support (co_await on Promise and Channel, Promise as a coroutine return type),
+//! it's enabled only if the compiler supports coroutines
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define KORS_ASYNC_COROUTINES
+#endif
+#endif
+
+#ifdef KORS_ASYNC_COROUTINES
+
+#include <coroutine>
+#include <stdexcept>
+#include <string>
+
+namespace kors::async {
+//! NOTE Thrown by `co_await` on a rejected promise,
+//! a coroutine returning a Promise is rejected with it, if it's not caught
+class RejectedError : public std::runtime_error
+{
+public:
+    RejectedError(int code, const std::string& msg)
+        : std::runtime_error(msg), m_code(code) {}
+
+    int code() const { return m_code; }
+
+private:
+    int m_code = 0;
+};
+}
+
+#endif
+
+#endif // KORS_ASYNC_COROUTINE_H
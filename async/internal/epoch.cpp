@@ -0,0 +1,207 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "epoch.h"
+
+using namespace kors::async;
+
+Epoch* Epoch::instance()
+{
+    //! NOTE Not destroyed on purpose, objects can be retired during static destruction
+    static Epoch* e = new Epoch();
+    return e;
+}
+
+Epoch::Guard::Guard()
+{
+    Epoch::instance()->pin();
+}
+
+Epoch::Guard::~Guard()
+{
+    Epoch::instance()->unpin();
+}
+
+Epoch::Record* Epoch::localRecord()
+{
+    struct Holder {
+        Record* record = nullptr;
+        ~Holder()
+        {
+            Epoch::instance()->releaseRecord(record);
+        }
+    };
+
+    thread_local Holder holder;
+    if (holder.record) {
+        return holder.record;
+    }
+
+    for (Record* r = m_records.load(std::memory_order_acquire); r; r = r->next) {
+        bool used = false;
+        if (r->used.compare_exchange_strong(used, true, std::memory_order_acquire)) {
+            holder.record = r;
+            return r;
+        }
+    }
+
+    Record* r = new Record();
+    r->used.store(true, std::memory_order_relaxed);
+    Record* head = m_records.load(std::memory_order_relaxed);
+    do {
+        r->next = head;
+    } while (!m_records.compare_exchange_weak(head, r, std::memory_order_release, std::memory_order_relaxed));
+
+    holder.record = r;
+    return r;
+}
+
+void Epoch::releaseRecord(Record* r)
+{
+    if (!r) {
+        return;
+    }
+
+    if (!r->retired.empty()) {
+        std::lock_guard<std::mutex> lock(m_orphansMutex);
+        m_orphans.insert(m_orphans.end(), r->retired.begin(), r->retired.end());
+        m_hasOrphans.store(true, std::memory_order_relaxed);
+        r->retired.clear();
+    }
+
+    r->nesting = 0;
+    r->state.store(0, std::memory_order_release);
+    r->used.store(false, std::memory_order_release);
+}
+
+void Epoch::pin()
+{
+    Record* r = localRecord();
+    if (r->nesting++ > 0) {
+        return;
+    }
+
+    uint64_t epoch = m_epoch.load(std::memory_order_relaxed);
+    r->state.store((epoch << 1) | 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void Epoch::unpin()
+{
+    Record* r = localRecord();
+    if (--r->nesting > 0) {
+        return;
+    }
+
+    r->state.store(0, std::memory_order_release);
+
+    //! NOTE Make progress if something is waiting for reclamation
+    if (!r->retired.empty()) {
+        collect(r);
+    }
+
+    if (m_hasOrphans.load(std::memory_order_relaxed)) {
+        collectOrphans();
+    }
+}
+
+void Epoch::retire(void* p, Deleter deleter)
+{
+    Record* r = localRecord();
+    r->retired.push_back({ p, deleter, m_epoch.load() });
+    collect(r);
+}
+
+bool Epoch::tryAdvance()
+{
+    uint64_t epoch = m_epoch.load();
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (Record* r = m_records.load(std::memory_order_acquire); r; r = r->next) {
+        uint64_t state = r->state.load(std::memory_order_acquire);
+        if ((state & 1) && (state >> 1) != epoch) {
+            return false;
+        }
+    }
+
+    //! NOTE If it fails, then someone else has advanced it
+    m_epoch.compare_exchange_strong(epoch, epoch + 1);
+    return true;
+}
+
+void Epoch::deleteReady(std::vector<Retired>& retired, uint64_t epoch)
+{
+    //! NOTE An object retired at epoch E can be deleted when the epoch is E + 2
+    std::vector<Retired> ready;
+    size_t kept = 0;
+    for (size_t i = 0; i < retired.size(); ++i) {
+        if (retired[i].epoch + 2 <= epoch) {
+            ready.push_back(retired[i]);
+        } else {
+            retired[kept++] = retired[i];
+        }
+    }
+    retired.resize(kept);
+
+    //! NOTE Deleters can retire other objects, so they are called after the list is updated
+    for (const Retired& r : ready) {
+        r.deleter(r.p);
+    }
+}
+
+void Epoch::collect(Record* r)
+{
+    //! NOTE If no one is pinned, this makes it possible to delete at once
+    if (tryAdvance()) {
+        tryAdvance();
+    }
+
+    std::vector<Retired> retired;
+    retired.swap(r->retired);
+    deleteReady(retired, m_epoch.load());
+    r->retired.insert(r->retired.end(), retired.begin(), retired.end());
+}
+
+void Epoch::collectOrphans()
+{
+    std::vector<Retired> orphans;
+    {
+        std::unique_lock<std::mutex> lock(m_orphansMutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            return;
+        }
+        orphans.swap(m_orphans);
+        m_hasOrphans.store(false, std::memory_order_relaxed);
+    }
+
+    if (tryAdvance()) {
+        tryAdvance();
+    }
+
+    deleteReady(orphans, m_epoch.load());
+
+    if (!orphans.empty()) {
+        std::lock_guard<std::mutex> lock(m_orphansMutex);
+        m_orphans.insert(m_orphans.end(), orphans.begin(), orphans.end());
+        m_hasOrphans.store(true, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,106 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef KORS_ASYNC_EPOCH_H
+#define KORS_ASYNC_EPOCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace kors::async {
+//! NOTE Epoch based reclamation.
+//! Readers pin the current epoch for the time they use shared objects (see Guard),
+//! writers unlink an object and retire it, the object is deleted only when
+//! all threads pinned at the time of retirement have left their epoch.
+//! Pinning and retiring touch only thread-local data, so threads don't contend with each other.
+class Epoch
+{
+public:
+
+    static Epoch* instance();
+
+    class Guard
+    {
+    public:
+        Guard();
+        ~Guard();
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    };
+
+    using Deleter = void (*)(void*);
+
+    void retire(void* p, Deleter deleter);
+
+    template<typename T>
+    void retire(T* p)
+    {
+        retire(p, [](void* d) { delete static_cast<T*>(d); });
+    }
+
+private:
+    Epoch() = default;
+
+    struct Retired {
+        void* p = nullptr;
+        Deleter deleter = nullptr;
+        uint64_t epoch = 0;
+    };
+
+    //! NOTE One record per thread, records are reused after a thread exits
+    struct Record {
+        //! NOTE 0 - not pinned, otherwise (epoch << 1) | 1
+        std::atomic<uint64_t> state = 0;
+        std::atomic<bool> used = false;
+        Record* next = nullptr;
+
+        //! NOTE Accessed only by the owner thread
+        int nesting = 0;
+        std::vector<Retired> retired;
+    };
+
+    Record* localRecord();
+    void releaseRecord(Record* r);
+
+    void pin();
+    void unpin();
+
+    bool tryAdvance();
+    void collect(Record* r);
+    void collectOrphans();
+    static void deleteReady(std::vector<Retired>& retired, uint64_t epoch);
+
+    std::atomic<uint64_t> m_epoch = 1;
+    std::atomic<Record*> m_records = nullptr;
+
+    //! NOTE Objects left by exited threads
+    std::mutex m_orphansMutex;
+    std::vector<Retired> m_orphans;
+    std::atomic<bool> m_hasOrphans = false;
+};
+}
+
+#endif // KORS_ASYNC_EPOCH_H
@@ -0,0 +1,117 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "inbox.h"
+
+#include "queuedinvoker.h"
+
+using namespace kors::async;
+
+Inbox::Inbox(Mode mode, const std::thread::id& th)
+    : m_mode(mode), m_threadID(th)
+{
+    if (m_threadID == std::this_thread::get_id()) {
+        QueuedInvoker::instance()->registerThread();
+    }
+}
+
+Inbox::~Inbox()
+{
+    Event* e = m_events.takeAll();
+    while (e) {
+        Event* next = e->next;
+        e->handler->release();
+        delete e;
+        e = next;
+    }
+}
+
+void Inbox::push(AbstractInvoker::ICall* handler, const NotifyData& data)
+{
+    Event* e = new Event();
+    handler->addRef();
+    e->handler = handler;
+    e->data = data;
+    m_events.push(e);
+
+    if (m_mode == Mode::Queued) {
+        schedule();
+    } else {
+        m_parking.unpark();
+    }
+}
+
+void Inbox::schedule()
+{
+    //! NOTE One queued drain for all the events pushed until it starts
+    if (m_scheduled.exchange(true, std::memory_order_acq_rel)) {
+        return;
+    }
+
+    std::weak_ptr<Inbox> weak = weak_from_this();
+    QueuedInvoker::instance()->invoke(m_threadID, [weak]() {
+        if (std::shared_ptr<Inbox> inbox = weak.lock()) {
+            inbox->drain();
+        }
+    }, true);
+}
+
+size_t Inbox::drain()
+{
+    assert(m_threadID == std::this_thread::get_id());
+
+    //! NOTE Reset before the events are taken, so a later push schedules a new drain
+    m_scheduled.store(false, std::memory_order_release);
+
+    size_t delivered = 0;
+    Event* e = m_events.takeAll();
+    while (e) {
+        Event* next = e->next;
+        if (!e->handler->isCancelled()) {
+            e->data.setMovable(true);
+            e->handler->call(e->data);
+            ++delivered;
+        }
+        e->handler->release();
+        delete e;
+        e = next;
+    }
+    return delivered;
+}
+
+size_t Inbox::select(const std::chrono::microseconds* timeout)
+{
+    auto isReady = [this]() {
+        return !m_events.empty();
+    };
+
+    if (!isReady()) {
+        if (timeout) {
+            m_parking.park(isReady, std::chrono::steady_clock::now() + *timeout);
+        } else {
+            m_parking.park(isReady);
+        }
+    }
+
+    return drain();
+}
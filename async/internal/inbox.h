@@ -0,0 +1,90 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef KORS_ASYNC_INBOX_H
+#define KORS_ASYNC_INBOX_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include "abstractinvoker.h"
+#include "mpscqueue.h"
+#include "parking.h"
+#include "pool.h"
+
+namespace kors::async {
+//! NOTE Ready events of many sources for one consumer (see Selector).
+//! The sources push the events (on the sending threads) into one lock-free queue,
+//! the consumer is woken up once for all of them and delivers them in one pass, in the push order
+class Inbox : public std::enable_shared_from_this<Inbox>
+{
+public:
+
+    enum class Mode {
+        //! NOTE Delivered by the processing of events of the consumer thread
+        Queued,
+        //! NOTE Delivered by `select` of the consumer thread
+        Blocking
+    };
+
+    Inbox(Mode mode, const std::thread::id& th);
+    ~Inbox();
+
+    Inbox(const Inbox&) = delete;
+    Inbox& operator=(const Inbox&) = delete;
+
+    //! NOTE Any thread, the handler is called with a copy of the data by the drain
+    void push(AbstractInvoker::ICall* handler, const NotifyData& data);
+
+    //! NOTE Consumer thread, returns the number of the delivered events
+    size_t drain();
+
+    //! NOTE Consumer thread, waits for an event (or until the timeout expires), then drains
+    size_t select(const std::chrono::microseconds* timeout);
+
+private:
+
+    struct Event : public Pooled {
+        Event* next = nullptr;
+        AbstractInvoker::ICall* handler = nullptr;
+        NotifyData data;
+    };
+
+    void schedule();
+
+    Mode m_mode = Mode::Queued;
+    std::thread::id m_threadID;
+
+    MpscQueue<Event> m_events;
+
+    //! NOTE A drain is queued to the consumer thread and not started yet
+    std::atomic<bool> m_scheduled = false;
+
+    //! NOTE Used only to park the consumer of a blocking inbox while it's empty
+    Parking m_parking;
+};
+}
+
+#endif // KORS_ASYNC_INBOX_H
@@ -0,0 +1,77 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef KORS_ASYNC_MPSCQUEUE_H
+#define KORS_ASYNC_MPSCQUEUE_H
+
+#include <atomic>
+
+namespace kors::async {
+//! NOTE Intrusive lock-free multi-producer/single-consumer queue.
+//! Producers push onto an atomic stack, the consumer takes the whole stack
+//! at once and restores the FIFO order, so `push` never blocks and the consumer
+//! never contends with other consumers.
+//! The node type must have a `Node* next` member.
+template<typename Node>
+class MpscQueue
+{
+public:
+    MpscQueue() = default;
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    //! NOTE Any thread. Returns true if the queue was empty before the push
+    bool push(Node* n)
+    {
+        Node* head = m_head.load(std::memory_order_relaxed);
+        do {
+            n->next = head;
+        } while (!m_head.compare_exchange_weak(head, n, std::memory_order_seq_cst, std::memory_order_relaxed));
+        return head == nullptr;
+    }
+
+    //! NOTE Consumer thread only. Returns the taken nodes in the push order
+    Node* takeAll()
+    {
+        Node* head = m_head.exchange(nullptr, std::memory_order_acquire);
+        Node* first = nullptr;
+        while (head) {
+            Node* next = head->next;
+            head->next = first;
+            first = head;
+            head = next;
+        }
+        return first;
+    }
+
+    bool empty() const
+    {
+        return m_head.load(std::memory_order_seq_cst) == nullptr;
+    }
+
+private:
+    std::atomic<Node*> m_head { nullptr };
+};
+}
+
+#endif // KORS_ASYNC_MPSCQUEUE_H
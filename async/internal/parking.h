@@ -0,0 +1,77 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef KORS_ASYNC_PARKING_H
+#define KORS_ASYNC_PARKING_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace kors::async {
+//! NOTE Parks one consumer thread until something is ready, for the queue of a thread and for a blocking inbox.
+//! The `waiting` flag is set before the readiness is checked under the lock,
+//! and producers check it after they publish, so a wakeup can't be lost
+class Parking
+{
+public:
+    Parking() = default;
+    Parking(const Parking&) = delete;
+    Parking& operator=(const Parking&) = delete;
+
+    //! NOTE Consumer thread only, returns at the deadline or when `isReady` returns true
+    template<typename Ready>
+    void park(Ready isReady, const std::chrono::steady_clock::time_point& deadline = std::chrono::steady_clock::time_point::max())
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_waiting.store(true);
+        if (deadline != std::chrono::steady_clock::time_point::max()) {
+            m_cond.wait_until(lock, deadline, isReady);
+        } else {
+            m_cond.wait(lock, isReady);
+        }
+        m_waiting.store(false);
+    }
+
+    //! NOTE Any thread, after the publish. Producers don't touch the mutex while the consumer is not parked
+    void unpark()
+    {
+        if (!m_waiting.load()) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+        }
+        m_cond.notify_one();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::atomic<bool> m_waiting = false;
+};
+}
+
+#endif // KORS_ASYNC_PARKING_H
@@ -0,0 +1,213 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "pool.h"
+
+#include <mutex>
+#include <vector>
+
+using namespace kors::async;
+
+namespace {
+constexpr size_t GRANULARITY = alignof(std::max_align_t);
+constexpr size_t MAX_SIZE = 256;
+constexpr size_t CLASSES = MAX_SIZE / GRANULARITY;
+constexpr size_t BATCH = 64;
+constexpr size_t CACHE_LIMIT = 4 * BATCH;
+
+struct FreeBlock {
+    FreeBlock* next = nullptr;
+};
+
+struct FreeList {
+    FreeBlock* head = nullptr;
+    size_t count = 0;
+
+    void push(FreeBlock* b)
+    {
+        b->next = head;
+        head = b;
+        ++count;
+    }
+
+    FreeBlock* pop()
+    {
+        FreeBlock* b = head;
+        if (b) {
+            head = b->next;
+            --count;
+        }
+        return b;
+    }
+};
+
+size_t sizeClass(size_t size)
+{
+    return (size + GRANULARITY - 1) / GRANULARITY - 1;
+}
+
+size_t blockSize(size_t cls)
+{
+    return (cls + 1) * GRANULARITY;
+}
+
+//! NOTE Shared by all threads, used only to refill and to drain the thread caches
+class Central
+{
+public:
+    static Central* instance()
+    {
+        //! NOTE Not destroyed on purpose, blocks can be freed during static destruction
+        static Central* c = new Central();
+        return c;
+    }
+
+    void take(size_t cls, FreeList& to)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        FreeList& from = m_lists[cls];
+        while (to.count < BATCH && from.head) {
+            to.push(from.pop());
+        }
+
+        if (to.head) {
+            return;
+        }
+
+        size_t size = blockSize(cls);
+        char* slab = static_cast<char*>(::operator new(size * BATCH));
+        m_slabs.push_back(slab);
+        for (size_t i = 0; i < BATCH; ++i) {
+            to.push(reinterpret_cast<FreeBlock*>(slab + i * size));
+        }
+    }
+
+    void give(size_t cls, FreeList& from, size_t count)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        FreeList& to = m_lists[cls];
+        for (size_t i = 0; i < count && from.head; ++i) {
+            to.push(from.pop());
+        }
+    }
+
+private:
+    std::mutex m_mutex;
+    FreeList m_lists[CLASSES];
+    std::vector<char*> m_slabs;
+};
+
+struct ThreadCache {
+    FreeList lists[CLASSES];
+
+    ~ThreadCache();
+};
+
+thread_local bool s_cacheDestroyed = false;
+
+ThreadCache::~ThreadCache()
+{
+    for (size_t cls = 0; cls < CLASSES; ++cls) {
+        Central::instance()->give(cls, lists[cls], lists[cls].count);
+    }
+    s_cacheDestroyed = true;
+}
+
+ThreadCache* threadCache()
+{
+    if (s_cacheDestroyed) {
+        return nullptr;
+    }
+
+    thread_local ThreadCache cache;
+    return &cache;
+}
+
+Pool::Allocator s_allocator;
+}
+
+void Pool::setAllocator(const Allocator& a)
+{
+    s_allocator = a;
+}
+
+void* Pool::allocate(size_t size)
+{
+    if (s_allocator.allocate) {
+        return s_allocator.allocate(size);
+    }
+
+    if (size == 0 || size > MAX_SIZE) {
+        return ::operator new(size);
+    }
+
+    size_t cls = sizeClass(size);
+    ThreadCache* cache = threadCache();
+    if (!cache) {
+        FreeList list;
+        Central::instance()->take(cls, list);
+        FreeBlock* b = list.pop();
+        Central::instance()->give(cls, list, list.count);
+        return b;
+    }
+
+    FreeList& list = cache->lists[cls];
+    if (!list.head) {
+        Central::instance()->take(cls, list);
+    }
+    return list.pop();
+}
+
+void Pool::deallocate(void* p, size_t size)
+{
+    if (!p) {
+        return;
+    }
+
+    if (s_allocator.deallocate) {
+        s_allocator.deallocate(p, size);
+        return;
+    }
+
+    if (size == 0 || size > MAX_SIZE) {
+        ::operator delete(p);
+        return;
+    }
+
+    size_t cls = sizeClass(size);
+    FreeBlock* b = new (p) FreeBlock();
+    ThreadCache* cache = threadCache();
+    if (!cache) {
+        FreeList list;
+        list.push(b);
+        Central::instance()->give(cls, list, 1);
+        return;
+    }
+
+    //! NOTE Blocks freed by a thread stay in its cache, the excess goes back to the central lists
+    FreeList& list = cache->lists[cls];
+    list.push(b);
+    if (list.count > CACHE_LIMIT) {
+        Central::instance()->give(cls, list, list.count - CACHE_LIMIT / 2);
+    }
+}
@@ -0,0 +1,108 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef KORS_ASYNC_POOL_H
+#define KORS_ASYNC_POOL_H
+
+#include <cstddef>
+#include <new>
+
+namespace kors::async {
+//! NOTE Allocator of the small internal objects (calls, queued deliveries, queue nodes, functors).
+//! By default blocks are taken from per-thread free lists of fixed size classes,
+//! so the steady state doesn't touch malloc. The allocation can be replaced with setAllocator,
+//! it must be done before anything is allocated.
+class Pool
+{
+public:
+
+    struct Allocator {
+        void* (*allocate)(size_t size) = nullptr;
+        void (*deallocate)(void* p, size_t size) = nullptr;
+    };
+
+    static void setAllocator(const Allocator& a);
+
+    static void* allocate(size_t size);
+    static void deallocate(void* p, size_t size);
+};
+
+//! NOTE Base for the internal objects allocated through the Pool
+struct Pooled {
+    static void* operator new(size_t size)
+    {
+        return Pool::allocate(size);
+    }
+
+    static void operator delete(void* p, size_t size)
+    {
+        Pool::deallocate(p, size);
+    }
+
+    //! NOTE Over-aligned objects are not pooled
+    static void* operator new(size_t size, std::align_val_t al)
+    {
+        return ::operator new(size, al);
+    }
+
+    static void operator delete(void* p, size_t size, std::align_val_t al)
+    {
+        ::operator delete(p, size, al);
+    }
+};
+
+//! NOTE For the standard containers and std::allocate_shared
+template<typename T>
+struct PoolAllocator {
+    using value_type = T;
+
+    PoolAllocator() = default;
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        if constexpr (alignof(T) > alignof(std::max_align_t)) {
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+        } else {
+            return static_cast<T*>(Pool::allocate(n * sizeof(T)));
+        }
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if constexpr (alignof(T) > alignof(std::max_align_t)) {
+            ::operator delete(p, n * sizeof(T), std::align_val_t(alignof(T)));
+        } else {
+            Pool::deallocate(p, n * sizeof(T));
+        }
+    }
+
+    template<typename U>
+    bool operator==(const PoolAllocator<U>&) const { return true; }
+    template<typename U>
+    bool operator!=(const PoolAllocator<U>&) const { return false; }
+};
+}
+
+#endif // KORS_ASYNC_POOL_H
@@ -23,42 +23,750 @@ SOFTWARE.
 */
 #include "queuedinvoker.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+#include "epoch.h"
+#include "trace.h"
+
 using namespace kors::async;
 
+//! NOTE A waiting lower lane gets one item after this number of items of the higher lanes
+static constexpr int STARVATION_LIMIT = 8;
+
 QueuedInvoker* QueuedInvoker::instance()
 {
-    static QueuedInvoker i;
-    return &i;
+    //! NOTE Not destroyed on purpose, the threads of the pool (never joined) and the threads which exit
+    //! during static destruction still use their queues
+    static QueuedInvoker* i = new QueuedInvoker();
+    return i;
+}
+
+//! NOTE The main thread (which runs the static initialization) can be called from the start
+static const bool s_mainRegistered = []() {
+    QueuedInvoker::instance()->registerThread();
+    return true;
+}();
+
+void QueuedInvoker::stopWaker()
+{
+    QueuedInvoker* qi = instance();
+    {
+        std::lock_guard<std::mutex> lock(qi->m_wakerMutex);
+        qi->m_wakerStop = true;
+    }
+    qi->m_wakerCond.notify_one();
+    if (qi->m_waker.joinable()) {
+        qi->m_waker.join();
+    }
+}
+
+QueuedInvoker::Queue::~Queue()
+{
+    //! NOTE The calls left for an exited thread are dropped
+    for (Lane& l : lanes) {
+        l.take();
+        while (Node* n = l.pop()) {
+            delete n;
+        }
+    }
+
+    for (Timer* t : timers) {
+        delete t;
+    }
+
+    delete notifier.load();
+#ifdef __linux__
+    if (eventFd >= 0) {
+        close(eventFd);
+    }
+#endif
+}
+
+QueuedInvoker::Queue* QueuedInvoker::queue(const std::thread::id& th)
+{
+    //! NOTE Must be called under Epoch::Guard, a removed queue stays valid until it's left.
+    //! Only the owner thread creates its queue (see localQueue), so the posts to an exited thread
+    //! (or to one with a recycled id) don't create a queue, which nobody would remove
+    if (th == std::this_thread::get_id()) {
+        return localQueue();
+    }
+
+    struct Cache {
+        uint64_t generation = 0;
+        std::unordered_map<std::thread::id, Queue*> queues;
+    };
+
+    thread_local Cache cache;
+    uint64_t generation = m_queuesGeneration.load();
+    if (cache.generation != generation) {
+        cache.queues.clear();
+        cache.generation = generation;
+    }
+
+    auto it = cache.queues.find(th);
+    if (it != cache.queues.end()) {
+        return it->second;
+    }
+
+    Queue* q = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = m_queues.find(th);
+        if (found == m_queues.end()) {
+            return nullptr;
+        }
+        q = found->second.get();
+    }
+
+    cache.queues[th] = q;
+    return q;
+}
+
+QueuedInvoker::Queue* QueuedInvoker::createQueue()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::unique_ptr<Queue>& p = m_queues[std::this_thread::get_id()];
+    if (!p) {
+        p = std::make_unique<Queue>();
+    }
+    return p.get();
 }
 
-void QueuedInvoker::invoke(const std::thread::id& callbackTh, const Functor& f, bool isAlwaysQueued)
+QueuedInvoker::Queue* QueuedInvoker::localQueue()
 {
+    //! NOTE The queue is removed at the exit of the thread
+    struct Holder {
+        Queue* q = nullptr;
+        Holder(QueuedInvoker* qi)
+        {
+            //! NOTE The record of Epoch is created before, so it's destroyed after (the queue is retired there)
+            Epoch::Guard guard;
+            q = qi->createQueue();
+        }
+
+        ~Holder()
+        {
+            QueuedInvoker::instance()->removeQueue(q);
+        }
+    };
+
+    thread_local Holder holder(this);
+    return holder.q;
+}
+
+void QueuedInvoker::registerThread()
+{
+    localQueue();
+}
+
+void QueuedInvoker::removeQueue(Queue* q)
+{
+    if (q->driven.load()) {
+        std::lock_guard<std::mutex> lock(m_wakerMutex);
+        m_driven.erase(std::remove(m_driven.begin(), m_driven.end(), q), m_driven.end());
+    }
+
+    Queue* main = q;
+    m_mainQueue.compare_exchange_strong(main, nullptr);
+
+    //! NOTE A new thread with the same id gets a new queue, the producers which still see this one
+    //! (by their caches) push into it until they see the new generation, these calls are dropped
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_queues.find(std::this_thread::get_id());
+        if (it != m_queues.end() && it->second.get() == q) {
+            it->second.release();
+            m_queues.erase(it);
+        }
+        m_queuesGeneration.fetch_add(1);
+    }
+
+    Epoch::instance()->retire(q);
+}
+
+bool QueuedInvoker::invoke(const std::thread::id& callbackTh, const Functor& f, bool isAlwaysQueued, Priority priority)
+{
+    //! NOTE The host delivers the calls of the main thread itself, they are not queued
     if (m_onMainThreadInvoke) {
         if (callbackTh == m_mainThreadID) {
             m_onMainThreadInvoke(f, isAlwaysQueued);
+            return true;
         }
     }
 
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
-    m_queues[callbackTh].push(f);
+    Epoch::Guard guard;
+    Queue* q = queue(callbackTh);
+    if (!q) {
+        return false;
+    }
+
+    Node* n = new Node(f);
+
+    Trace::Scope scope("post");
+    if (scope.name) {
+        n->flowID = Trace::newFlowID();
+        Trace::record(Trace::Phase::FlowStart, "flow", n->flowID);
+    }
+#ifdef KORS_ASYNC_STATS
+    n->queued = Clock::now();
+    size_t depth = q->depth.fetch_add(1, std::memory_order_relaxed) + 1;
+    size_t highWater = q->highWater.load(std::memory_order_relaxed);
+    while (depth > highWater && !q->highWater.compare_exchange_weak(highWater, depth, std::memory_order_relaxed)) {
+    }
+#endif
+    q->lanes[int(priority)].nodes.push(n);
+    wakeup(q);
+    notify(q);
+    return true;
 }
 
-void QueuedInvoker::processEvents()
+QueuedInvoker::TimerID QueuedInvoker::newTimerID()
+{
+    return m_lastTimerID.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+QueuedInvoker::TimerID QueuedInvoker::invokeAfter(const std::thread::id& th, const std::chrono::microseconds& delay,
+                                                  const std::chrono::microseconds& interval, const TimerFunctor& f, TimerID id)
+{
+    Timer* t = new Timer(Clock::now() + delay, interval, f);
+    t->id = id ? id : newTimerID();
+    id = t->id;
+    if (th == std::this_thread::get_id()) {
+        addTimer(localQueue(), t);
+        return id;
+    }
+
+    if (!invoke(th, [this, t]() { addTimer(localQueue(), t); }, true)) {
+        delete t;
+    }
+    return id;
+}
+
+void QueuedInvoker::cancelTimers(const std::thread::id& th, const std::vector<TimerID>& ids)
+{
+    if (ids.empty()) {
+        return;
+    }
+
+    if (th == std::this_thread::get_id()) {
+        removeTimers(localQueue(), ids);
+        return;
+    }
+
+    invoke(th, [this, ids]() { removeTimers(localQueue(), ids); }, true);
+}
+
+std::chrono::microseconds QueuedInvoker::nextTimerTimeout()
+{
+    Queue* q = localQueue();
+    popCancelled(q);
+    if (q->timers.empty()) {
+        return std::chrono::microseconds::max();
+    }
+
+    //! NOTE Rounded up, so the loop doesn't wake up just before the deadline and spin
+    Clock::duration left = q->timers.front()->deadline - Clock::now();
+    if (left <= Clock::duration::zero()) {
+        return std::chrono::microseconds(0);
+    }
+    return std::chrono::ceil<std::chrono::microseconds>(left);
+}
+
+void QueuedInvoker::addTimer(Queue* q, Timer* t)
+{
+    t->seq = q->timerSeq++;
+    q->timers.push_back(t);
+    std::push_heap(q->timers.begin(), q->timers.end(), TimerLater());
+    q->timerIndex[t->id] = t;
+    scheduleWake(q);
+}
+
+void QueuedInvoker::removeTimers(Queue* q, std::vector<TimerID> ids)
+{
+    //! NOTE The functors are called after the heap is updated, they may add timers
+    std::vector<TimerFunctor> cancelled;
+    for (TimerID id : ids) {
+        auto it = q->timerIndex.find(id);
+        if (it == q->timerIndex.end()) {
+            continue;
+        }
+
+        Timer* t = it->second;
+        q->timerIndex.erase(it);
+        t->cancelled = true;
+        cancelled.push_back(std::move(t->f));
+        t->f = nullptr;
+        ++q->cancelledTimers;
+    }
+
+    //! NOTE A cancelled timer not found here (not added yet, or being repeated) is dropped when it's due
+    if (q->cancelledTimers * 2 > q->timers.size()) {
+        compactTimers(q);
+    } else {
+        popCancelled(q);
+    }
+    scheduleWake(q);
+
+    for (TimerFunctor& f : cancelled) {
+        f();
+    }
+}
+
+void QueuedInvoker::compactTimers(Queue* q)
 {
-    Queue q;
+    auto end = std::remove_if(q->timers.begin(), q->timers.end(), [](Timer* t) {
+        if (t->cancelled) {
+            delete t;
+            return true;
+        }
+        return false;
+    });
+    q->timers.erase(end, q->timers.end());
+    std::make_heap(q->timers.begin(), q->timers.end(), TimerLater());
+    q->cancelledTimers = 0;
+}
+
+void QueuedInvoker::popCancelled(Queue* q)
+{
+    while (!q->timers.empty() && q->timers.front()->cancelled) {
+        std::pop_heap(q->timers.begin(), q->timers.end(), TimerLater());
+        delete q->timers.back();
+        q->timers.pop_back();
+        --q->cancelledTimers;
+    }
+}
+
+void QueuedInvoker::processTimers(Queue* q)
+{
+    if (q->timers.empty()) {
+        return;
+    }
+
+    //! NOTE Repeating timers are added back after the loop, so a short interval can't hold the thread here
+    std::vector<Timer*> repeated;
+    Clock::time_point now = Clock::now();
+    while (!q->timers.empty() && q->timers.front()->deadline <= now) {
+        std::pop_heap(q->timers.begin(), q->timers.end(), TimerLater());
+        Timer* t = q->timers.back();
+        q->timers.pop_back();
+
+        if (t->cancelled) {
+            --q->cancelledTimers;
+            delete t;
+            continue;
+        }
+
+        q->timerIndex.erase(t->id);
+        if (t->f()) {
+            //! NOTE Missed intervals are skipped
+            t->deadline += t->interval;
+            if (t->deadline <= now) {
+                t->deadline = now + t->interval;
+            }
+            repeated.push_back(t);
+        } else {
+            delete t;
+        }
+    }
+
+    for (Timer* t : repeated) {
+        addTimer(q, t);
+    }
+
+    popCancelled(q);
+    scheduleWake(q);
+}
+
+void QueuedInvoker::setDriven(Queue* q)
+{
+    if (q->driven.exchange(true)) {
+        return;
+    }
+
     {
-        std::lock_guard<std::recursive_mutex> lock(m_mutex);
-        auto n = m_queues.extract(std::this_thread::get_id());
-        if (!n.empty()) {
-            q = n.mapped();
+        std::lock_guard<std::mutex> lock(m_wakerMutex);
+        m_driven.push_back(q);
+        if (!m_waker.joinable() && !m_wakerStop) {
+            //! NOTE The waker calls the host (see wake), it is stopped before the statics
+            //! created before it are destroyed
+            std::atexit(&QueuedInvoker::stopWaker);
+            m_waker = std::thread([this]() { wakerLoop(); });
+        }
+    }
+
+    //! NOTE Timers may be already added
+    scheduleWake(q);
+}
+
+void QueuedInvoker::scheduleWake(Queue* q)
+{
+    //! NOTE Called by the owner thread after the heap is changed
+    if (!q->driven.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    Clock::rep at = std::numeric_limits<Clock::rep>::max();
+    if (!q->timers.empty()) {
+        at = q->timers.front()->deadline.time_since_epoch().count();
+    }
+
+    //! NOTE The waker sleeps at most until the old deadline, it needs to know only about an earlier one
+    Clock::rep old = q->wakeAt.exchange(at);
+    if (at < old) {
+        {
+            std::lock_guard<std::mutex> lock(m_wakerMutex);
         }
+        m_wakerCond.notify_one();
     }
-    while (!q.empty()) {
-        const auto& f = q.front();
-        if (f) {
-            f();
+}
+
+void QueuedInvoker::wakerLoop()
+{
+    std::unique_lock<std::mutex> lock(m_wakerMutex);
+    std::vector<Queue*> due;
+    while (!m_wakerStop) {
+        Clock::rep now = Clock::now().time_since_epoch().count();
+        Clock::rep next = std::numeric_limits<Clock::rep>::max();
+        {
+            //! NOTE The queues of exited threads are removed from the list and retired,
+            //! the due ones are used out of the lock, but not out of the guard
+            Epoch::Guard guard;
+            for (Queue* q : m_driven) {
+                Clock::rep at = q->wakeAt.load();
+                if (at > now) {
+                    next = std::min(next, at);
+                    continue;
+                }
+
+                //! NOTE The owner publishes the next deadline when it processes the timers
+                if (q->wakeAt.compare_exchange_strong(at, std::numeric_limits<Clock::rep>::max())) {
+                    due.push_back(q);
+                }
+            }
+
+            if (!due.empty()) {
+                lock.unlock();
+                for (Queue* q : due) {
+                    wake(q);
+                }
+                due.clear();
+                lock.lock();
+                continue;
+            }
+        }
+
+        if (next == std::numeric_limits<Clock::rep>::max()) {
+            m_wakerCond.wait(lock);
+        } else {
+            m_wakerCond.wait_until(lock, Clock::time_point(Clock::duration(next)));
+        }
+    }
+}
+
+void QueuedInvoker::wake(Queue* q)
+{
+    //! NOTE The host of the main thread doesn't call processEvents, the timers are passed to it as a call
+    if (q == m_mainQueue && m_onMainThreadInvoke) {
+        m_onMainThreadInvoke([this]() { processTimers(localQueue()); }, true);
+        return;
+    }
+
+    notify(q);
+}
+
+void QueuedInvoker::processEvents()
+{
+    processQueue(localQueue());
+}
+
+size_t QueuedInvoker::processEvents(size_t maxItems)
+{
+    Queue* q = localQueue();
+    processQueue(q, maxItems);
+    return q->pendingCount();
+}
+
+size_t QueuedInvoker::processEvents(const std::chrono::microseconds& budget)
+{
+    Queue* q = localQueue();
+    Clock::time_point deadline = Clock::now() + budget;
+    processQueue(q, SIZE_MAX, &deadline);
+    return q->pendingCount();
+}
+
+void QueuedInvoker::waitAndProcessEvents()
+{
+    Queue* q = localQueue();
+    wait(q, nullptr);
+    processQueue(q);
+}
+
+void QueuedInvoker::waitAndProcessEvents(const std::chrono::microseconds& timeout)
+{
+    Queue* q = localQueue();
+    wait(q, &timeout);
+    processQueue(q);
+}
+
+void QueuedInvoker::runLoop()
+{
+    Queue* q = localQueue();
+    for (;;) {
+        processQueue(q);
+        if (q->exitRequested.exchange(false)) {
+            break;
+        }
+        wait(q, nullptr);
+    }
+}
+
+void QueuedInvoker::exitLoop(const std::thread::id& th)
+{
+    Epoch::Guard guard;
+    Queue* q = queue(th);
+    if (!q) {
+        return;
+    }
+
+    q->exitRequested.store(true);
+    wakeup(q);
+}
+
+void QueuedInvoker::wait(Queue* q, const std::chrono::microseconds* timeout)
+{
+    auto isReady = [q]() {
+        return q->hasNodes() || q->exitRequested.load();
+    };
+
+    if (isReady()) {
+        return;
+    }
+
+    //! NOTE The thread is parked at most until the nearest timer
+    Clock::time_point now = Clock::now();
+    Clock::time_point deadline = Clock::time_point::max();
+    if (timeout) {
+        deadline = now + *timeout;
+    }
+    if (!q->timers.empty()) {
+        deadline = std::min(deadline, q->timers.front()->deadline);
+    }
+
+    if (deadline <= now) {
+        return;
+    }
+
+    q->parking.park(isReady, deadline);
+}
+
+void QueuedInvoker::wakeup(Queue* q)
+{
+    q->parking.unpark();
+}
+
+void QueuedInvoker::notify(Queue* q)
+{
+    if (!q->notifier.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    if (q->notified.exchange(true)) {
+        return;
+    }
+
+    Epoch::Guard guard;
+    if (Notifier* f = q->notifier.load(std::memory_order_acquire)) {
+        (*f)();
+    }
+}
+
+void QueuedInvoker::setNotifier(const Notifier& f)
+{
+    Queue* q = localQueue();
+    Notifier* old = q->notifier.exchange(f ? new Notifier(f) : nullptr, std::memory_order_acq_rel);
+    if (old) {
+        Epoch::instance()->retire(old);
+    }
+
+    //! NOTE Something may be already queued
+    q->notified.store(false);
+    if (q->hasNodes()) {
+        notify(q);
+    }
+
+    if (f) {
+        setDriven(q);
+    }
+}
+
+int QueuedInvoker::eventFd()
+{
+#ifdef __linux__
+    Queue* q = localQueue();
+    if (q->eventFd < 0) {
+        q->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (q->eventFd < 0) {
+            return -1;
+        }
+
+        int fd = q->eventFd;
+        setNotifier([fd]() {
+            uint64_t one = 1;
+            ssize_t r = write(fd, &one, sizeof(one));
+            (void)r;
+        });
+    }
+    return q->eventFd;
+#else
+    return -1;
+#endif
+}
+
+void QueuedInvoker::Lane::take()
+{
+    Node* first = nodes.takeAll();
+    if (!first) {
+        return;
+    }
+
+    if (tail) {
+        tail->next = first;
+    } else {
+        head = first;
+    }
+
+    tail = first;
+    ++count;
+    while (tail->next) {
+        tail = tail->next;
+        ++count;
+    }
+}
+
+QueuedInvoker::Node* QueuedInvoker::Lane::pop()
+{
+    Node* n = head;
+    if (n) {
+        head = n->next;
+        if (!head) {
+            tail = nullptr;
+        }
+        n->next = nullptr;
+        --count;
+    }
+    return n;
+}
+
+bool QueuedInvoker::Queue::hasNodes() const
+{
+    for (const Lane& l : lanes) {
+        if (l.head || !l.nodes.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t QueuedInvoker::Queue::pendingCount()
+{
+    size_t n = 0;
+    for (Lane& l : lanes) {
+        l.take();
+        n += l.count;
+    }
+    return n;
+}
+
+int QueuedInvoker::nextLane(Queue* q)
+{
+    for (int i = PRIORITY_COUNT - 1; i > 0; --i) {
+        if (q->lanes[i].head && q->lanes[i].skipped >= STARVATION_LIMIT) {
+            return i;
+        }
+    }
+
+    for (int i = 0; i < PRIORITY_COUNT; ++i) {
+        if (q->lanes[i].head) {
+            return i;
         }
-        q.pop();
+    }
+    return -1;
+}
+
+void QueuedInvoker::processQueue(Queue* q, size_t maxItems, const Clock::time_point* deadline)
+{
+    //! NOTE Only the events queued before the processing are processed (so a functor which queues
+    //! itself again doesn't hold the thread), except the high ones, which are taken
+    //! again before each lower one.
+    //! The events over the limits are left in the lanes for the next processing,
+    //! at least one is processed, so the processing always progresses
+    Trace::Scope scope("processEvents");
+
+    //! NOTE Reset before the lanes are taken, so anything queued after that notifies again
+    q->notified.store(false);
+#ifdef __linux__
+    if (q->eventFd >= 0) {
+        uint64_t value = 0;
+        ssize_t r = read(q->eventFd, &value, sizeof(value));
+        (void)r;
+    }
+#endif
+
+    for (Lane& l : q->lanes) {
+        l.take();
+    }
+
+    Lane& high = q->lanes[int(Priority::High)];
+    for (size_t done = 0;; ++done) {
+        if (done > 0 && (done >= maxItems || (deadline && Clock::now() >= *deadline))) {
+            break;
+        }
+
+        if (!high.head && (q->lanes[int(Priority::Normal)].head || q->lanes[int(Priority::Background)].head)) {
+            high.take();
+        }
+
+        int i = nextLane(q);
+        if (i < 0) {
+            break;
+        }
+
+        q->lanes[i].skipped = 0;
+        for (int j = i + 1; j < PRIORITY_COUNT; ++j) {
+            if (q->lanes[j].head) {
+                ++q->lanes[j].skipped;
+            }
+        }
+
+        Node* n = q->lanes[i].pop();
+        Trace::Scope deliver("deliver");
+        if (deliver.name && n->flowID) {
+            Trace::record(Trace::Phase::FlowEnd, "flow", n->flowID);
+        }
+#ifdef KORS_ASYNC_STATS
+        q->depth.fetch_sub(1, std::memory_order_relaxed);
+        q->processed.store(q->processed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic<uint64_t>& bucket = q->latency[Stats::latencyBucket(Clock::now() - n->queued)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+#endif
+        if (n->f) {
+            n->f();
+        }
+        delete n;
+    }
+
+    processTimers(q);
+
+    //! NOTE The events left over the limits (or queued while processing) need the next processing
+    if (q->hasNodes()) {
+        notify(q);
     }
 }
 
@@ -66,4 +774,29 @@ void QueuedInvoker::onMainThreadInvoke(const std::function<void(const std::funct
 {
     m_onMainThreadInvoke = f;
     m_mainThreadID = std::this_thread::get_id();
+    m_mainQueue = localQueue();
+    if (f) {
+        setDriven(localQueue());
+    }
+}
+
+void QueuedInvoker::queueStats(std::vector<Stats::QueueStats>& stats)
+{
+#ifdef KORS_ASYNC_STATS
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& p : m_queues) {
+        const Queue* q = p.second.get();
+        Stats::QueueStats s;
+        s.threadID = p.first;
+        s.depth = q->depth.load(std::memory_order_relaxed);
+        s.highWater = q->highWater.load(std::memory_order_relaxed);
+        s.processed = q->processed.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < Stats::LATENCY_BUCKETS; ++i) {
+            s.latency[i] = q->latency[i].load(std::memory_order_relaxed);
+        }
+        stats.push_back(s);
+    }
+#else
+    (void)stats;
+#endif
 }
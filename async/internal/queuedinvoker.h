@@ -24,11 +24,24 @@ SOFTWARE.
 #ifndef KORS_ASYNC_QUEUEDINVOKER_H
 #define KORS_ASYNC_QUEUEDINVOKER_H
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
 #include <functional>
-#include <queue>
+#include <limits>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "mpscqueue.h"
+#include "parking.h"
+#include "pool.h"
+#include "priority.h"
+#include "stats.h"
 
 namespace kors::async {
 class QueuedInvoker
@@ -39,21 +52,190 @@ public:
 
     using Functor = std::function<void ()>;
 
-    void invoke(const std::thread::id& th, const Functor& f, bool isAlwaysQueued = false);
+    //! NOTE Returns false if the thread `th` has no queue (it has exited, or has never processed events
+    //! nor registered a receiver), then `f` is dropped
+    bool invoke(const std::thread::id& th, const Functor& f, bool isAlwaysQueued = false, Priority priority = Priority::Normal);
+
+    //! NOTE Creates the queue of the current thread (if it's not yet), so it can be called from other threads.
+    //! It is also created by the processing of events and by the registration of a receiver
+    void registerThread();
+
+    using Clock = std::chrono::steady_clock;
+
+    //! NOTE Returns true to be called again
+    using TimerFunctor = std::function<bool ()>;
+
+    using TimerID = uint64_t;
+    TimerID newTimerID();
+
+    //! NOTE `f` is called by the processing of events of the thread `th` after `delay`,
+    //! then after each `interval` while it returns true.
+    //! Returns the id of the timer (`id`, if given, see newTimerID)
+    TimerID invokeAfter(const std::thread::id& th, const std::chrono::microseconds& delay, const std::chrono::microseconds& interval,
+                        const TimerFunctor& f, TimerID id = 0);
+
+    //! NOTE The timers are removed by the thread `th` (on its next processing), their functors are called
+    //! once right away, so they release what they hold: they must see themselves that they are cancelled
+    void cancelTimers(const std::thread::id& th, const std::vector<TimerID>& ids);
+
+    //! NOTE Time until the nearest timer of the current thread (zero if it's due), max if there are none,
+    //! for a native event loop which arms its own timer
+    std::chrono::microseconds nextTimerTimeout();
+
     void processEvents();
+    size_t processEvents(size_t maxItems);
+    size_t processEvents(const std::chrono::microseconds& budget);
+    void waitAndProcessEvents();
+    void waitAndProcessEvents(const std::chrono::microseconds& timeout);
+    void runLoop();
+    void exitLoop(const std::thread::id& th);
     void onMainThreadInvoke(const std::function<void(const std::function<void()>&, bool)>& f);
 
+    //! NOTE Wakes up a native event loop of the current thread, which then calls `processEvents`.
+    //! Called (on the sending thread) once when the queue of the thread becomes non-empty,
+    //! then again only after the next processing, if something is still queued
+    using Notifier = std::function<void ()>;
+    void setNotifier(const Notifier& f);
+
+    //! NOTE An eventfd of the current thread (Linux only, otherwise -1), becomes readable
+    //! when something is queued, to be polled by epoll/select. It is reset by the processing of events
+    int eventFd();
+
+    void queueStats(std::vector<Stats::QueueStats>& stats);
+
 private:
 
     QueuedInvoker() = default;
+    ~QueuedInvoker() = default;
+
+    struct Node : public Pooled {
+        Node* next = nullptr;
+        Functor f;
+        uint64_t flowID = 0;
+#ifdef KORS_ASYNC_STATS
+        Clock::time_point queued;
+#endif
+        Node(const Functor& fn)
+            : f(fn) {}
+    };
+
+    struct Timer : public Pooled {
+        Clock::time_point deadline;
+        std::chrono::microseconds interval;
+        uint64_t seq = 0;
+        TimerID id = 0;
+        bool cancelled = false;
+        TimerFunctor f;
+        Timer(const Clock::time_point& d, const std::chrono::microseconds& i, const TimerFunctor& fn)
+            : deadline(d), interval(i), f(fn) {}
+    };
+
+    struct TimerLater {
+        bool operator()(const Timer* a, const Timer* b) const
+        {
+            return a->deadline > b->deadline || (a->deadline == b->deadline && a->seq > b->seq);
+        }
+    };
 
-    using Queue = std::queue<Functor>;
+    //! NOTE Producers push into `nodes`, the owner thread takes them into its local list
+    struct Lane {
+        MpscQueue<Node> nodes;
+        Node* head = nullptr;
+        Node* tail = nullptr;
+        size_t count = 0;
 
-    std::recursive_mutex m_mutex;
-    std::map<std::thread::id, Queue > m_queues;
+        //! NOTE The number of items of the higher lanes run while this one was waiting
+        int skipped = 0;
+
+        void take();
+        Node* pop();
+    };
+
+    //! NOTE Each consumer thread owns its queue, producers push into it without locks.
+    //! The queue is removed at the exit of the thread and retired through Epoch,
+    //! so the producers use it under Epoch::Guard
+    struct Queue {
+        ~Queue();
+
+        Lane lanes[PRIORITY_COUNT];
+
+        bool hasNodes() const;
+        size_t pendingCount();
+
+#ifdef KORS_ASYNC_STATS
+        //! NOTE `depth` is changed by the producers and the owner, the rest only by the owner thread
+        std::atomic<size_t> depth = 0;
+        std::atomic<size_t> highWater = 0;
+        std::atomic<uint64_t> processed = 0;
+        std::array<std::atomic<uint64_t>, Stats::LATENCY_BUCKETS> latency {};
+#endif
+
+        //! NOTE Min-heap by the deadline, touched only by the owner thread,
+        //! timers for other threads are added through the nodes
+        std::vector<Timer*> timers;
+        uint64_t timerSeq = 0;
+        //! NOTE Cancelled timers still in the heap, it is compacted when they are the half of it
+        size_t cancelledTimers = 0;
+        //! NOTE The timers in the heap by id, so a cancel doesn't scan it
+        std::unordered_map<TimerID, Timer*> timerIndex;
+
+        //! NOTE The thread is driven by a native event loop (a notifier or the host of the main thread),
+        //! the nearest deadline is published for the waker (see wakerLoop)
+        std::atomic<bool> driven = false;
+        std::atomic<Clock::rep> wakeAt = std::numeric_limits<Clock::rep>::max();
+
+        //! NOTE Used only to park the owner thread while the queue is empty
+        Parking parking;
+        std::atomic<bool> exitRequested = false;
+
+        //! NOTE Replaced notifiers are retired through Epoch, the producers call it under Epoch::Guard
+        std::atomic<Notifier*> notifier = nullptr;
+        //! NOTE The notifier was called since the start of the last processing
+        std::atomic<bool> notified = false;
+        int eventFd = -1;
+    };
+
+    Queue* queue(const std::thread::id& th);
+    Queue* localQueue();
+    Queue* createQueue();
+    void removeQueue(Queue* q);
+
+    void processQueue(Queue* q, size_t maxItems = SIZE_MAX, const Clock::time_point* deadline = nullptr);
+    static int nextLane(Queue* q);
+    void addTimer(Queue* q, Timer* t);
+    void processTimers(Queue* q);
+    void removeTimers(Queue* q, std::vector<TimerID> ids);
+    void compactTimers(Queue* q);
+    void popCancelled(Queue* q);
+
+    //! NOTE Nobody calls processEvents of a driven thread when its timer is due,
+    //! so a waker thread notifies it (or passes the timers to the host of the main thread)
+    void setDriven(Queue* q);
+    void scheduleWake(Queue* q);
+    void wakerLoop();
+    static void stopWaker();
+    void wake(Queue* q);
+    void wait(Queue* q, const std::chrono::microseconds* timeout);
+    void wakeup(Queue* q);
+    void notify(Queue* q);
+
+    //! NOTE Guards only the registration of the queues, lookups are cached per thread,
+    //! the caches are dropped when the generation is changed (a queue is removed)
+    std::mutex m_mutex;
+    std::map<std::thread::id, std::unique_ptr<Queue> > m_queues;
+    std::atomic<uint64_t> m_queuesGeneration = 0;
 
     std::function<void(const std::function<void()>&, bool)> m_onMainThreadInvoke;
     std::thread::id m_mainThreadID;
+    std::atomic<Queue*> m_mainQueue = nullptr;
+
+    std::atomic<TimerID> m_lastTimerID = 0;
+
+    std::mutex m_wakerMutex;
+    std::condition_variable m_wakerCond;
+    std::thread m_waker;
+    bool m_wakerStop = false;
+    std::vector<Queue*> m_driven;
 };
 }
 
@@ -0,0 +1,95 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef KORS_ASYNC_RINGBUFFER_H
+#define KORS_ASYNC_RINGBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace kors::async {
+//! NOTE Fixed capacity lock-free queue for one producer and one consumer thread.
+//! The positions only grow, the slot is `position % capacity`.
+//! The positions are published with seq cst, so the owners can combine them
+//! with their own flags (wakeups, sleeping producers) without lost notifications.
+template<typename T>
+class RingBuffer
+{
+public:
+    explicit RingBuffer(size_t capacity)
+        : m_slots(capacity > 0 ? capacity : 1) {}
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    size_t capacity() const
+    {
+        return m_slots.size();
+    }
+
+    //! NOTE Producer, `v` is moved only if there is a free slot
+    bool push(T& v)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_seq_cst) >= m_slots.size()) {
+            return false;
+        }
+
+        m_slots[tail % m_slots.size()] = std::move(v);
+        m_tail.store(tail + 1, std::memory_order_seq_cst);
+        return true;
+    }
+
+    //! NOTE Consumer
+    bool pop(T& v)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_seq_cst)) {
+            return false;
+        }
+
+        T& slot = m_slots[head % m_slots.size()];
+        v = std::move(slot);
+        slot = T();
+        m_head.store(head + 1, std::memory_order_seq_cst);
+        return true;
+    }
+
+    //! NOTE Producer
+    bool full() const
+    {
+        return m_tail.load(std::memory_order_relaxed) - m_head.load(std::memory_order_seq_cst) >= m_slots.size();
+    }
+
+private:
+    std::vector<T> m_slots;
+
+    //! NOTE On different cache lines, the producer and the consumer don't bounce each other's line
+    alignas(64) std::atomic<size_t> m_head = 0;
+    alignas(64) std::atomic<size_t> m_tail = 0;
+};
+}
+
+#endif // KORS_ASYNC_RINGBUFFER_H
@@ -0,0 +1,409 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "sharedring.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#ifdef __linux__
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace kors::async;
+
+#ifdef __linux__
+
+static constexpr uint32_t MAGIC = 0x4b525247;
+static constexpr uint32_t VERSION = 1;
+static constexpr size_t CACHE_LINE = 64;
+
+//! NOTE How long `open` waits for another process to finish the creation of the segment
+static constexpr int OPEN_ATTEMPTS = 1000;
+
+//! NOTE Placed at the start of the segment, the slots follow it
+struct SharedRing::Header {
+    std::atomic<uint32_t> ready = 0;
+    uint32_t version = VERSION;
+    uint64_t capacity = 0;
+    uint64_t slotSize = 0;
+    uint64_t signature = 0;
+
+    //! NOTE The next position to push and to pop, they only grow, the slot is `position % capacity`
+    alignas(CACHE_LINE) std::atomic<uint64_t> head = 0;
+    alignas(CACHE_LINE) std::atomic<uint64_t> tail = 0;
+
+    //! NOTE Futex words, changed after each push (pop), the waiting side sleeps while they don't change
+    alignas(CACHE_LINE) std::atomic<uint32_t> dataSeq = 0;
+    std::atomic<uint32_t> dataWaiters = 0;
+    alignas(CACHE_LINE) std::atomic<uint32_t> spaceSeq = 0;
+    std::atomic<uint32_t> spaceWaiters = 0;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+              "the atomics in the shared memory must be lock-free");
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "a futex word is a plain 32-bit integer");
+
+using Sequence = std::atomic<uint64_t>;
+
+static size_t alignUp(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+static void futexWait(std::atomic<uint32_t>* word, uint32_t expected)
+{
+    //! NOTE Not FUTEX_PRIVATE, the word is shared between the processes
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected, nullptr, nullptr, 0);
+}
+
+static void futexWake(std::atomic<uint32_t>* word, int count)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, count, nullptr, nullptr, 0);
+}
+
+static std::string shmPath(const std::string& name)
+{
+    return name.front() == '/' ? name : "/" + name;
+}
+
+std::shared_ptr<SharedRing> SharedRing::open(const std::string& name, size_t capacity, size_t slotSize, uint64_t signature)
+{
+    if (name.empty() || capacity == 0) {
+        return nullptr;
+    }
+
+    const std::string path = shmPath(name);
+    const size_t headerSize = alignUp(sizeof(Header), CACHE_LINE);
+    const size_t stride = alignUp(sizeof(Sequence) + slotSize, CACHE_LINE);
+    const size_t mapSize = headerSize + capacity * stride;
+
+    bool created = true;
+    int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        created = false;
+        fd = shm_open(path.c_str(), O_RDWR, 0600);
+    }
+
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    if (created) {
+        if (ftruncate(fd, off_t(mapSize)) != 0) {
+            close(fd);
+            shm_unlink(path.c_str());
+            return nullptr;
+        }
+    } else {
+        //! NOTE The creator may not have sized it yet
+        struct stat st {};
+        for (int i = 0; i < OPEN_ATTEMPTS; ++i) {
+            if (fstat(fd, &st) != 0 || st.st_size != 0) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        if (size_t(st.st_size) != mapSize) {
+            close(fd);
+            return nullptr;
+        }
+    }
+
+    void* map = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return nullptr;
+    }
+
+    std::shared_ptr<SharedRing> ring(new SharedRing());
+    ring->m_map = map;
+    ring->m_mapSize = mapSize;
+    ring->m_header = static_cast<Header*>(map);
+    ring->m_slotSize = slotSize;
+    ring->m_slotStride = stride;
+    ring->m_capacity = capacity;
+
+    Header* h = ring->m_header;
+    if (created) {
+        new (h) Header();
+        h->capacity = capacity;
+        h->slotSize = slotSize;
+        h->signature = signature;
+        //! NOTE A slot is free for the producer of the position `seq`,
+        //! ready for the consumer of `seq - 1`
+        for (uint64_t i = 0; i < capacity; ++i) {
+            new (ring->slot(i)) Sequence(i);
+        }
+        h->ready.store(MAGIC, std::memory_order_release);
+    } else {
+        for (int i = 0; i < OPEN_ATTEMPTS && h->ready.load(std::memory_order_acquire) != MAGIC; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        if (h->ready.load(std::memory_order_acquire) != MAGIC || h->version != VERSION
+            || h->capacity != capacity || h->slotSize != slotSize || h->signature != signature) {
+            //! NOTE The destructor unmaps it
+            return nullptr;
+        }
+    }
+
+    return ring;
+}
+
+bool SharedRing::unlink(const std::string& name)
+{
+    if (name.empty()) {
+        return false;
+    }
+    return shm_unlink(shmPath(name).c_str()) == 0;
+}
+
+SharedRing::~SharedRing()
+{
+    //! NOTE The reader thread keeps the ring alive, so it can be the last owner only on its own thread
+    if (m_reader.joinable()) {
+        if (m_reader.get_id() == std::this_thread::get_id()) {
+            m_reader.detach();
+        } else {
+            m_reader.join();
+        }
+    }
+
+    if (m_map) {
+        munmap(m_map, m_mapSize);
+    }
+}
+
+unsigned char* SharedRing::slot(uint64_t pos) const
+{
+    return static_cast<unsigned char*>(m_map) + alignUp(sizeof(Header), CACHE_LINE) + (pos % m_capacity) * m_slotStride;
+}
+
+bool SharedRing::push(const void* data, bool wait)
+{
+    Header* h = m_header;
+    for (;;) {
+        uint64_t pos = h->head.load(std::memory_order_relaxed);
+        for (;;) {
+            unsigned char* s = slot(pos);
+            Sequence* seq = reinterpret_cast<Sequence*>(s);
+            int64_t diff = int64_t(seq->load(std::memory_order_acquire) - pos);
+            if (diff == 0) {
+                if (h->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    std::memcpy(s + sizeof(Sequence), data, m_slotSize);
+                    seq->store(pos + 1, std::memory_order_release);
+
+                    h->dataSeq.fetch_add(1);
+                    //! NOTE All of them, a reader which has no receivers doesn't take the value
+                    if (h->dataWaiters.load() > 0) {
+                        futexWake(&h->dataSeq, INT_MAX);
+                    }
+                    return true;
+                }
+            } else if (diff < 0) {
+                //! NOTE Full, the slot still holds the value of the previous round
+                break;
+            } else {
+                pos = h->head.load(std::memory_order_relaxed);
+            }
+        }
+
+        if (!wait) {
+            return false;
+        }
+
+        //! NOTE The counter is read before the ring is checked again, and the consumer changes it
+        //! after each pop, so the wakeup can't be lost (see readLoop)
+        uint32_t space = h->spaceSeq.load();
+        h->spaceWaiters.fetch_add(1);
+        if (h->head.load() - h->tail.load() >= m_capacity) {
+            futexWait(&h->spaceSeq, space);
+        }
+        h->spaceWaiters.fetch_sub(1);
+    }
+}
+
+bool SharedRing::pop(void* data)
+{
+    Header* h = m_header;
+    uint64_t pos = h->tail.load(std::memory_order_relaxed);
+    for (;;) {
+        unsigned char* s = slot(pos);
+        Sequence* seq = reinterpret_cast<Sequence*>(s);
+        int64_t diff = int64_t(seq->load(std::memory_order_acquire) - (pos + 1));
+        if (diff == 0) {
+            if (h->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                std::memcpy(data, s + sizeof(Sequence), m_slotSize);
+                seq->store(pos + m_capacity, std::memory_order_release);
+
+                h->spaceSeq.fetch_add(1);
+                if (h->spaceWaiters.load() > 0) {
+                    futexWake(&h->spaceSeq, INT_MAX);
+                }
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = h->tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void SharedRing::startReading(const Reader& reader)
+{
+    std::lock_guard<std::mutex> lock(m_readerMutex);
+    ++m_readerStarts;
+    if (m_reading || m_stopReading.load()) {
+        return;
+    }
+
+    //! NOTE The previous thread has ended (or is just returning)
+    if (m_reader.joinable()) {
+        m_reader.join();
+    }
+
+    m_reading = true;
+    std::shared_ptr<SharedRing> self = shared_from_this();
+    m_reader = std::thread([self, reader]() {
+        self->readLoop(reader);
+    });
+}
+
+void SharedRing::stopReading()
+{
+    std::thread reader;
+    {
+        std::lock_guard<std::mutex> lock(m_readerMutex);
+        m_stopReading.store(true);
+        reader.swap(m_reader);
+    }
+
+    //! NOTE The counter is changed, so a reader which is about to sleep doesn't
+    m_header->dataSeq.fetch_add(1);
+    futexWake(&m_header->dataSeq, INT_MAX);
+
+    if (reader.joinable()) {
+        if (reader.get_id() == std::this_thread::get_id()) {
+            reader.detach();
+        } else {
+            reader.join();
+        }
+    }
+}
+
+void SharedRing::readLoop(Reader reader)
+{
+    Header* h = m_header;
+    for (;;) {
+        uint64_t starts = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_readerMutex);
+            starts = m_readerStarts;
+        }
+
+        if (m_stopReading.load()) {
+            break;
+        }
+
+        if (!reader(this)) {
+            std::lock_guard<std::mutex> lock(m_readerMutex);
+            if (m_readerStarts != starts && !m_stopReading.load()) {
+                continue;
+            }
+            m_reading = false;
+            return;
+        }
+
+        uint32_t data = h->dataSeq.load();
+        h->dataWaiters.fetch_add(1);
+        if (h->head.load() == h->tail.load() && !m_stopReading.load()) {
+            futexWait(&h->dataSeq, data);
+        }
+        h->dataWaiters.fetch_sub(1);
+    }
+
+    std::lock_guard<std::mutex> lock(m_readerMutex);
+    m_reading = false;
+}
+
+#else
+
+struct SharedRing::Header {};
+
+std::shared_ptr<SharedRing> SharedRing::open(const std::string&, size_t, size_t, uint64_t)
+{
+    return nullptr;
+}
+
+bool SharedRing::unlink(const std::string&)
+{
+    return false;
+}
+
+SharedRing::~SharedRing() = default;
+
+unsigned char* SharedRing::slot(uint64_t) const
+{
+    return nullptr;
+}
+
+bool SharedRing::push(const void*, bool)
+{
+    return false;
+}
+
+bool SharedRing::pop(void*)
+{
+    return false;
+}
+
+void SharedRing::startReading(const Reader&)
+{
+}
+
+void SharedRing::stopReading()
+{
+}
+
+void SharedRing::readLoop(Reader)
+{
+}
+
+#endif
+
+size_t SharedRing::slotSize() const
+{
+    return m_slotSize;
+}
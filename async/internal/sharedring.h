@@ -0,0 +1,106 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef KORS_ASYNC_SHAREDRING_H
+#define KORS_ASYNC_SHAREDRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace kors::async {
+//! NOTE Fixed capacity lock-free queue of fixed size slots in a named shared memory segment,
+//! for any number of producer and consumer processes (each value is popped by one consumer).
+//! A slot has a sequence number which tells whether it is free for the producer of a position
+//! or ready for its consumer, so the producers and the consumers don't lock each other.
+//! The waiting sides sleep on futexes in the segment, the other side wakes them up only if someone sleeps.
+//! Linux only, `open` returns nullptr on other platforms
+class SharedRing : public std::enable_shared_from_this<SharedRing>
+{
+public:
+
+    //! NOTE Creates the segment or opens the existing one, which must have the same capacity, slot size
+    //! and signature (of the layout of the values), returns nullptr on failure
+    static std::shared_ptr<SharedRing> open(const std::string& name, size_t capacity, size_t slotSize, uint64_t signature);
+
+    //! NOTE Removes the name of the segment, the processes which have it opened keep using it
+    static bool unlink(const std::string& name);
+
+    ~SharedRing();
+
+    SharedRing(const SharedRing&) = delete;
+    SharedRing& operator=(const SharedRing&) = delete;
+
+    size_t slotSize() const;
+
+    //! NOTE Copies `slotSize` bytes of `data` into the ring,
+    //! if it is full, waits for a free slot or returns false (if `wait` is false)
+    bool push(const void* data, bool wait);
+
+    //! NOTE Copies the next value into `data` (`slotSize` bytes), returns false if the ring is empty
+    bool pop(void* data);
+
+    //! NOTE Called by the reading thread when the ring may have values, the reader pops them itself
+    //! (as long as it wants to), returns false to stop the reading
+    using Reader = std::function<bool (SharedRing* ring)>;
+
+    //! NOTE Starts a thread which calls `reader`, sleeping while the ring is empty.
+    //! Has no effect while the reading is running, but a reader which is about to stop is called again
+    void startReading(const Reader& reader);
+
+    //! NOTE The reader is not called after this returns (unless called by the reader itself),
+    //! the reading can't be started again
+    void stopReading();
+
+private:
+
+    struct Header;
+
+    SharedRing() = default;
+
+    unsigned char* slot(uint64_t pos) const;
+    void readLoop(Reader reader);
+
+    void* m_map = nullptr;
+    size_t m_mapSize = 0;
+    Header* m_header = nullptr;
+    size_t m_slotSize = 0;
+    size_t m_slotStride = 0;
+    uint64_t m_capacity = 0;
+
+    //! NOTE Guards the start and the end of the reading thread
+    std::mutex m_readerMutex;
+    std::thread m_reader;
+    bool m_reading = false;
+    //! NOTE Changed by each start, so the thread doesn't end when it's started again while ending
+    uint64_t m_readerStarts = 0;
+    std::atomic<bool> m_stopReading = false;
+};
+}
+
+#endif // KORS_ASYNC_SHAREDRING_H
@@ -0,0 +1,118 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stats.h"
+
+#include <algorithm>
+
+#include "queuedinvoker.h"
+
+using namespace kors::async;
+
+Stats* Stats::instance()
+{
+    //! NOTE Not destroyed on purpose, the counters can be touched during static destruction
+    static Stats* s = []() {
+        Stats* stats = new Stats();
+        stats->m_exited.shared = true;
+        return stats;
+    }();
+    return s;
+}
+
+namespace {
+//! NOTE Trivially destructible, so it's valid during the whole exit of the thread
+thread_local Stats::Counters* t_counters = nullptr;
+thread_local bool t_exited = false;
+}
+
+Stats::Counters* Stats::local()
+{
+    if (t_counters) {
+        return t_counters;
+    }
+
+    //! NOTE The objects destroyed after the holder (by other thread locals) are counted in the shared block
+    if (t_exited) {
+        return &instance()->m_exited;
+    }
+
+    //! NOTE The counts of a finished thread are added to the total, its objects can still be alive
+    //! (they are counted where they are destroyed)
+    struct Holder {
+        Holder()
+        {
+            Stats* s = instance();
+            std::lock_guard<std::mutex> lock(s->m_mutex);
+            t_counters = new Counters();
+            s->m_counters.push_back(t_counters);
+        }
+
+        ~Holder()
+        {
+            Stats* s = instance();
+            std::lock_guard<std::mutex> lock(s->m_mutex);
+            s->m_exited.batches.fetch_add(t_counters->batches.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            s->m_exited.calls.fetch_add(t_counters->calls.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            s->m_counters.erase(std::find(s->m_counters.begin(), s->m_counters.end(), t_counters));
+            delete t_counters;
+            t_counters = nullptr;
+            t_exited = true;
+        }
+    };
+
+    thread_local Holder holder;
+    return t_counters;
+}
+
+size_t Stats::latencyBucket(const std::chrono::steady_clock::duration& d)
+{
+    uint64_t us = uint64_t(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(d).count()));
+    size_t i = 0;
+    while (i < LATENCY_BUCKETS - 1 && (uint64_t(1) << i) < us) {
+        ++i;
+    }
+    return i;
+}
+
+Stats::Snapshot Stats::snapshot()
+{
+    Snapshot snap;
+    if (!isEnabled()) {
+        return snap;
+    }
+
+    Stats* s = instance();
+    {
+        std::lock_guard<std::mutex> lock(s->m_mutex);
+        snap.liveBatches = s->m_exited.batches.load(std::memory_order_relaxed);
+        snap.liveCalls = s->m_exited.calls.load(std::memory_order_relaxed);
+        for (const Counters* c : s->m_counters) {
+            snap.liveBatches += c->batches.load(std::memory_order_relaxed);
+            snap.liveCalls += c->calls.load(std::memory_order_relaxed);
+        }
+    }
+
+    QueuedInvoker::instance()->queueStats(snap.queues);
+    return snap;
+}
@@ -0,0 +1,112 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef KORS_ASYNC_STATS_H
+#define KORS_ASYNC_STATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kors::async {
+//! NOTE Runtime counters, they are compiled in only if KORS_ASYNC_STATS is defined,
+//! otherwise nothing is counted and the snapshot is empty.
+//! The counters are relaxed atomics, mostly written by one thread (per-thread counters,
+//! or by the owner thread of a queue), so they don't add contention
+class Stats
+{
+public:
+
+    //! NOTE Bucket `i` counts the events run within 2^i microseconds after they were queued,
+    //! the last one counts the rest
+    static constexpr size_t LATENCY_BUCKETS = 24;
+
+    struct QueueStats {
+        std::thread::id threadID;
+        size_t depth = 0;
+        size_t highWater = 0;
+        uint64_t processed = 0;
+        std::array<uint64_t, LATENCY_BUCKETS> latency {};
+    };
+
+    struct Snapshot {
+        std::vector<QueueStats> queues;
+
+        //! NOTE Queued deliveries of notifications (one per destination thread)
+        int64_t liveBatches = 0;
+
+        //! NOTE Pending Async::call
+        int64_t liveCalls = 0;
+    };
+
+    static constexpr bool isEnabled()
+    {
+#ifdef KORS_ASYNC_STATS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    static Snapshot snapshot();
+
+    //! NOTE Written only by the own thread, a counter can be negative
+    //! (an object created on one thread and destroyed on another)
+    struct Counters {
+        std::atomic<int64_t> batches = 0;
+        std::atomic<int64_t> calls = 0;
+        //! NOTE The block of the threads which are exiting, it's written by several of them
+        bool shared = false;
+    };
+
+    using Counter = std::atomic<int64_t> Counters::*;
+
+    static void add(Counter counter, int64_t v)
+    {
+        Counters* c = local();
+        if (c->shared) {
+            (c->*counter).fetch_add(v, std::memory_order_relaxed);
+            return;
+        }
+        (c->*counter).store((c->*counter).load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+
+    static size_t latencyBucket(const std::chrono::steady_clock::duration& d);
+
+private:
+    static Stats* instance();
+    static Counters* local();
+
+    std::mutex m_mutex;
+    std::vector<Counters*> m_counters;
+    //! NOTE The counts of the exited threads (and of the exiting ones, see local)
+    Counters m_exited;
+};
+}
+
+#endif // KORS_ASYNC_STATS_H
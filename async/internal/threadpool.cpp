@@ -0,0 +1,166 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "threadpool.h"
+
+using namespace kors::async;
+
+namespace {
+//! NOTE The pool and the index of the current worker thread
+thread_local ThreadPool* s_pool = nullptr;
+thread_local size_t s_index = 0;
+}
+
+ThreadPool* ThreadPool::instance()
+{
+    //! NOTE Not destroyed on purpose, tasks can be posted during static destruction
+    static ThreadPool* p = new ThreadPool();
+    return p;
+}
+
+ThreadPool::ThreadPool(size_t threads)
+{
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    for (size_t i = 0; i < threads; ++i) {
+        m_workers.push_back(std::make_unique<Worker>());
+    }
+
+    for (size_t i = 0; i < threads; ++i) {
+        m_workers.at(i)->thread = std::thread([this, i]() { run(i); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_all();
+
+    for (std::unique_ptr<Worker>& w : m_workers) {
+        w->thread.join();
+    }
+}
+
+size_t ThreadPool::size() const
+{
+    return m_workers.size();
+}
+
+bool ThreadPool::isWorkerThread() const
+{
+    return s_pool == this;
+}
+
+void ThreadPool::post(Task task)
+{
+    bool local = isWorkerThread();
+    size_t index = local ? s_index : m_next.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+    Worker* w = m_workers.at(index).get();
+
+    //! NOTE Counted before the task is visible, so a worker which takes it can't decrement the counter below zero.
+    //! Seq cst - pairs with the check of the sleeping worker, so the wakeup is not lost
+    m_pending.fetch_add(1, std::memory_order_seq_cst);
+    {
+        std::lock_guard<std::mutex> lock(w->mutex);
+        if (local) {
+            w->tasks.push_back(std::move(task));
+        } else {
+            w->external.push_back(std::move(task));
+        }
+    }
+
+    if (m_sleeping.load(std::memory_order_seq_cst) > 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cond.notify_one();
+    }
+}
+
+bool ThreadPool::pop(size_t index, Task& task)
+{
+    Worker* w = m_workers.at(index).get();
+    std::lock_guard<std::mutex> lock(w->mutex);
+    if (!w->tasks.empty()) {
+        task = std::move(w->tasks.back());
+        w->tasks.pop_back();
+        return true;
+    }
+
+    if (!w->external.empty()) {
+        task = std::move(w->external.front());
+        w->external.pop_front();
+        return true;
+    }
+
+    return false;
+}
+
+bool ThreadPool::steal(size_t index, Task& task)
+{
+    for (size_t i = 1; i < m_workers.size(); ++i) {
+        Worker* w = m_workers.at((index + i) % m_workers.size()).get();
+        std::lock_guard<std::mutex> lock(w->mutex);
+        if (!w->external.empty()) {
+            task = std::move(w->external.front());
+            w->external.pop_front();
+            return true;
+        }
+
+        if (!w->tasks.empty()) {
+            task = std::move(w->tasks.front());
+            w->tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run(size_t index)
+{
+    s_pool = this;
+    s_index = index;
+
+    for (;;) {
+        Task task;
+        if (pop(index, task) || steal(index, task)) {
+            m_pending.fetch_sub(1, std::memory_order_relaxed);
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_sleeping.fetch_add(1, std::memory_order_seq_cst);
+        m_cond.wait(lock, [this]() {
+            return m_stop || m_pending.load(std::memory_order_seq_cst) > 0;
+        });
+        m_sleeping.fetch_sub(1, std::memory_order_relaxed);
+
+        if (m_stop && m_pending.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,91 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef KORS_ASYNC_THREADPOOL_H
+#define KORS_ASYNC_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kors::async {
+//! NOTE Executor with a fixed number of worker threads.
+//! Each worker has its own deque for the tasks posted by the worker itself: the owner takes them from the back
+//! (the most recent, still hot in the cache), idle workers steal from the front of the others,
+//! so the load is balanced without a shared queue.
+//! Tasks posted from outside the pool are distributed between the workers round robin, into their external queues,
+//! which are taken from the front, so the external tasks of one worker start in the post order.
+//! There is no ordering guarantee between the workers, nor between the tasks posted by the workers.
+class ThreadPool
+{
+public:
+
+    //! NOTE The default pool, sized to the number of cores
+    static ThreadPool* instance();
+
+    using Task = std::function<void ()>;
+
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency());
+
+    //! NOTE Runs the remaining tasks and joins the workers
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const;
+    bool isWorkerThread() const;
+
+    void post(Task task);
+
+private:
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::deque<Task> external;
+        std::thread thread;
+    };
+
+    void run(size_t index);
+    bool pop(size_t index, Task& task);
+    bool steal(size_t index, Task& task);
+
+    std::vector<std::unique_ptr<Worker> > m_workers;
+    std::atomic<size_t> m_next = 0;
+
+    //! NOTE Number of the tasks in all deques, idle workers sleep while it's zero
+    std::atomic<size_t> m_pending = 0;
+    std::atomic<size_t> m_sleeping = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_stop = false;
+};
+}
+
+#endif // KORS_ASYNC_THREADPOOL_H
@@ -0,0 +1,196 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+
+using namespace kors::async;
+
+std::atomic<bool> Trace::s_enabled = false;
+
+namespace {
+std::atomic<uint64_t> s_lastFlowID = 0;
+
+uint64_t now()
+{
+    static const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count());
+}
+
+std::string microseconds(uint64_t ns)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%llu.%03llu", (unsigned long long)(ns / 1000), (unsigned long long)(ns % 1000));
+    return buf;
+}
+}
+
+Trace* Trace::instance()
+{
+    //! NOTE Not destroyed on purpose, events can be recorded during static destruction
+    static Trace* t = new Trace();
+    return t;
+}
+
+void Trace::setEnabled(bool enabled)
+{
+    now();
+    s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+uint64_t Trace::newFlowID()
+{
+    return s_lastFlowID.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+Trace::Buffer* Trace::local()
+{
+    //! NOTE The buffer of a finished thread is kept until the export, if it has events
+    struct Holder {
+        Buffer* buffer = new Buffer();
+        Holder()
+        {
+            Trace* t = instance();
+            std::lock_guard<std::mutex> lock(t->m_mutex);
+            buffer->tid = ++t->m_lastTid;
+            t->m_buffers.push_back(buffer);
+        }
+
+        ~Holder()
+        {
+            Trace* t = instance();
+            std::lock_guard<std::mutex> lock(t->m_mutex);
+            if (buffer->head.load(std::memory_order_relaxed) != buffer->start.load(std::memory_order_relaxed)) {
+                buffer->finished = true;
+                return;
+            }
+
+            t->m_buffers.erase(std::find(t->m_buffers.begin(), t->m_buffers.end(), buffer));
+            delete buffer;
+        }
+    };
+
+    thread_local Holder holder;
+    return holder.buffer;
+}
+
+void Trace::removeFinished()
+{
+    auto end = std::remove_if(m_buffers.begin(), m_buffers.end(), [](Buffer* b) {
+        if (b->finished) {
+            delete b;
+            return true;
+        }
+        return false;
+    });
+    m_buffers.erase(end, m_buffers.end());
+}
+
+void Trace::record(Phase phase, const char* name, uint64_t flowID)
+{
+    Buffer* b = local();
+    uint64_t pos = b->head.load(std::memory_order_relaxed);
+    Event& e = b->events[pos % CAPACITY];
+
+    //! NOTE Orders the overwrite after the previous head store, for the check of the export
+    std::atomic_thread_fence(std::memory_order_release);
+    e.ts.store(now(), std::memory_order_relaxed);
+    e.flowID.store(flowID, std::memory_order_relaxed);
+    e.name.store(name, std::memory_order_relaxed);
+    e.phase.store(char(phase), std::memory_order_relaxed);
+    b->head.store(pos + 1, std::memory_order_release);
+}
+
+void Trace::clear()
+{
+    Trace* t = instance();
+    std::lock_guard<std::mutex> lock(t->m_mutex);
+    for (Buffer* b : t->m_buffers) {
+        b->start.store(b->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+    t->removeFinished();
+}
+
+void Trace::writeChromeJson(std::ostream& out)
+{
+    Trace* t = instance();
+    std::lock_guard<std::mutex> lock(t->m_mutex);
+
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    auto separator = [&out, &first]() {
+        if (!first) {
+            out << ",\n";
+        }
+        first = false;
+    };
+
+    for (Buffer* b : t->m_buffers) {
+        separator();
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b->tid
+            << ",\"args\":{\"name\":\"thread " << b->tid << "\"}}";
+
+        uint64_t head = b->head.load(std::memory_order_acquire);
+        uint64_t from = std::max(b->start.load(std::memory_order_relaxed), head > CAPACITY ? head - CAPACITY : 0);
+        for (uint64_t pos = from; pos < head; ++pos) {
+            const Event& e = b->events[pos % CAPACITY];
+            uint64_t ts = e.ts.load(std::memory_order_relaxed);
+            uint64_t flowID = e.flowID.load(std::memory_order_relaxed);
+            const char* name = e.name.load(std::memory_order_relaxed);
+            char phase = e.phase.load(std::memory_order_relaxed);
+
+            //! NOTE Overwritten while it was read
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (b->head.load(std::memory_order_relaxed) >= pos + CAPACITY) {
+                continue;
+            }
+
+            separator();
+            out << "{\"name\":\"" << (name ? name : "") << "\",\"cat\":\"async\",\"ph\":\"" << phase
+                << "\",\"ts\":" << microseconds(ts) << ",\"pid\":1,\"tid\":" << b->tid;
+            if (phase == char(Phase::FlowStart) || phase == char(Phase::FlowEnd)) {
+                out << ",\"id\":" << flowID;
+                if (phase == char(Phase::FlowEnd)) {
+                    out << ",\"bp\":\"e\"";
+                }
+            }
+            out << "}";
+        }
+    }
+
+    out << "]}\n";
+
+    //! NOTE The events of the exited threads are exported, they aren't needed anymore
+    t->removeFinished();
+}
+
+std::string Trace::chromeJson()
+{
+    std::ostringstream out;
+    writeChromeJson(out);
+    return out.str();
+}
@@ -0,0 +1,123 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef KORS_ASYNC_TRACE_H
+#define KORS_ASYNC_TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace kors::async {
+//! NOTE Records slices (send, post, deliver, processEvents) and flows linking a post on one thread
+//! to the delivery on another. Each thread writes into its own ring buffer without locks,
+//! the oldest events are overwritten. Disabled by default, then a hook costs a relaxed load.
+//! The export is the Chrome trace JSON (it is opened by Perfetto too)
+class Trace
+{
+public:
+
+    enum class Phase : char {
+        Begin = 'B',
+        End = 'E',
+        FlowStart = 's',
+        FlowEnd = 'f'
+    };
+
+    //! NOTE Events per thread
+    static constexpr size_t CAPACITY = 1 << 16;
+
+    static void setEnabled(bool enabled);
+    static bool isEnabled()
+    {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+
+    static uint64_t newFlowID();
+
+    //! NOTE `name` must be a static string
+    static void record(Phase phase, const char* name, uint64_t flowID = 0);
+
+    static void writeChromeJson(std::ostream& out);
+    static std::string chromeJson();
+    static void clear();
+
+    //! NOTE Records a slice for the scope, if the tracing is enabled
+    struct Scope {
+        const char* name = nullptr;
+        explicit Scope(const char* n)
+        {
+            if (isEnabled()) {
+                name = n;
+                record(Phase::Begin, name);
+            }
+        }
+
+        ~Scope()
+        {
+            if (name) {
+                record(Phase::End, name);
+            }
+        }
+    };
+
+private:
+
+    //! NOTE Fields are atomic, as the exporting thread can read an event being overwritten,
+    //! such events are detected by the position and skipped
+    struct Event {
+        std::atomic<uint64_t> ts = 0;
+        std::atomic<uint64_t> flowID = 0;
+        std::atomic<const char*> name = nullptr;
+        std::atomic<char> phase = 0;
+    };
+
+    struct Buffer {
+        size_t tid = 0;
+        std::atomic<uint64_t> head = 0;
+        std::atomic<uint64_t> start = 0;
+        std::vector<Event> events = std::vector<Event>(CAPACITY);
+
+        //! NOTE The thread has exited, the buffer is deleted after its events are exported (or cleared)
+        bool finished = false;
+    };
+
+    static Trace* instance();
+    static Buffer* local();
+
+    //! NOTE Under the mutex
+    void removeFinished();
+
+    static std::atomic<bool> s_enabled;
+
+    std::mutex m_mutex;
+    std::vector<Buffer*> m_buffers;
+    size_t m_lastTid = 0;
+};
+}
+
+#endif // KORS_ASYNC_TRACE_H
@@ -37,9 +37,10 @@ public:
     }
 
     template<typename Func>
-    void onNotify(const Asyncable* receiver, Func f, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetOnce)
+    void onNotify(const Asyncable* receiver, Func f, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetOnce,
+                  Asyncable::Delivery delivery = Asyncable::Delivery::Queued)
     {
-        m_ch.onReceive(receiver, f, mode);
+        m_ch.onReceive(receiver, f, mode, delivery);
     }
 
     void resetOnNotify(const Asyncable* receiver)
@@ -64,6 +65,8 @@ public:
     }
 
 private:
+    friend class Selector;
+
     Channel<> m_ch;
 };
 }
@@ -25,17 +25,108 @@ SOFTWARE.
 #define KORS_ASYNC_PROCESSEVENTS_H
 
 #include "internal/abstractinvoker.h"
+#include "internal/trace.h"
 
 namespace kors::async {
+//! NOTE Calls can be sent to a thread once it has a queue: the queue is created when the thread
+//! processes (or waits for) events, registers a receiver or calls this (for the main thread at the start).
+//! The calls for other threads are dropped
+inline void registerThread()
+{
+    AbstractInvoker::registerThread();
+}
+
 inline void processEvents()
 {
     AbstractInvoker::processEvents();
 }
 
+//! NOTE Process at most `maxItems` events (or for about `budget`, at least one event is processed, due timers are fired),
+//! the rest stays queued. Return the number of the events still queued for the thread,
+//! so the host loop can spread the work across frames
+inline size_t processEvents(size_t maxItems)
+{
+    return AbstractInvoker::processEvents(maxItems);
+}
+
+inline size_t processEvents(const std::chrono::microseconds& budget)
+{
+    return AbstractInvoker::processEvents(budget);
+}
+
+//! NOTE Parks the thread until something is queued for it (or the timeout expires), then processes the events
+inline void waitAndProcessEvents()
+{
+    AbstractInvoker::waitAndProcessEvents();
+}
+
+inline void waitAndProcessEvents(const std::chrono::microseconds& timeout)
+{
+    AbstractInvoker::waitAndProcessEvents(timeout);
+}
+
+//! NOTE Processes events of the current thread until `exitLoop` is called for it
+inline void runLoop()
+{
+    AbstractInvoker::runLoop();
+}
+
+inline void exitLoop(const std::thread::id& th = std::this_thread::get_id())
+{
+    AbstractInvoker::exitLoop(th);
+}
+
+//! NOTE Runtime counters (queue depths, latencies, live objects), empty unless KORS_ASYNC_STATS is defined
+inline Stats::Snapshot stats()
+{
+    return Stats::snapshot();
+}
+
+//! NOTE Records the sends, posts and deliveries (with flows between the threads), see Trace
+inline void setTracingEnabled(bool enabled)
+{
+    Trace::setEnabled(enabled);
+}
+
+//! NOTE Chrome trace JSON, can be opened in chrome://tracing or Perfetto
+inline void writeTrace(std::ostream& out)
+{
+    Trace::writeChromeJson(out);
+}
+
+//! NOTE Replaces the allocation of the internal objects, must be called before anything is allocated
+inline void setAllocator(const Pool::Allocator& a)
+{
+    Pool::setAllocator(a);
+}
+
+//! NOTE The calls for the main thread are passed to `f` instead of being queued (see setNotifier for any thread)
 inline void onMainThreadInvoke(const std::function<void(const std::function<void()>&, bool)>& f)
 {
     AbstractInvoker::onMainThreadInvoke(f);
 }
+
+//! NOTE Integration with a native event loop of the current thread: `f` is called (on the sending thread)
+//! when something is queued for the thread, once until the next `processEvents`, which the loop should then call
+inline void setNotifier(const std::function<void()>& f)
+{
+    AbstractInvoker::setNotifier(f);
+}
+
+//! NOTE An eventfd to poll (epoll/select) in a native event loop of the current thread,
+//! when readable, `processEvents` should be called. Linux only, otherwise -1
+inline int eventFd()
+{
+    return AbstractInvoker::eventFd();
+}
+
+//! NOTE Time until the nearest timer (callAfter, callEvery) of the current thread, max if there are none.
+//! The timers of a thread with a notifier (or of the main thread with onMainThreadInvoke) are signalled anyway,
+//! a loop, which waits with a timeout itself (epoll_wait, ...), can use it instead
+inline std::chrono::microseconds nextTimerTimeout()
+{
+    return AbstractInvoker::nextTimerTimeout();
+}
 }
 
 #endif // KORS_ASYNC_PROCESSEVENTS_H
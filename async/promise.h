@@ -25,18 +25,45 @@ SOFTWARE.
 #define KORS_ASYNC_PROMISE_H
 
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
 
 #include "internal/abstractinvoker.h"
+#include "internal/coroutine.h"
 #include "async.h"
 
 namespace kors::async {
 template<typename ... T>
 class Promise;
+
+//! NOTE The type of the promise returned by a continuation (see Promise::map)
+template<typename R>
+struct PromiseOf {
+    using type = Promise<R>;
+};
+
+template<>
+struct PromiseOf<void> {
+    using type = Promise<>;
+};
+
+template<typename R>
+struct IsPromise : std::false_type {};
+
+template<typename ... T>
+struct IsPromise<Promise<T...> > : std::true_type {};
+
 template<typename ... T>
 class Promise
 {
 public:
+    struct Resolve;
+    struct Reject;
+
     // Dummy struct, with the purpose to enforce that the body
     // of a Promise resolves OR rejects exactly once
     struct Result {
@@ -63,6 +90,13 @@ public:
             return {};
         }
 
+        template<bool HasArgs = (sizeof...(T) > 0), std::enable_if_t<HasArgs, int> = 0>
+        [[nodiscard]] Result operator ()(T&& ... val) const
+        {
+            p.resolve(std::move(val)...);
+            return {};
+        }
+
     private:
         mutable Promise<T...> p;
     };
@@ -117,6 +151,18 @@ public:
         }, body, th);
     }
 
+    //! NOTE The body runs on a worker of the pool,
+    //! the result is delivered to the subscribers on their threads
+    Promise(Body body, ThreadPool* pool)
+    {
+        Resolve res(*this);
+        Reject rej(*this);
+
+        Async::call(nullptr, [res, rej](Body body) mutable {
+            body(res, rej);
+        }, body, pool);
+    }
+
     Promise(const Promise& p)
         : m_ptr(p.ptr()) {}
 
@@ -132,38 +178,269 @@ public:
         return *this;
     }
 
+    //! NOTE If the promise is already resolved, `f` is called right away with the stored result.
+    //! With the direct delivery `f` is called on the thread which resolves the promise
     template<typename Call>
-    Promise<T...>& onResolve(const Asyncable* caller, Call f)
+    Promise<T...>& onResolve(const Asyncable* caller, Call f, Asyncable::Delivery delivery = Asyncable::Delivery::Queued)
     {
-        ptr()->addCallBack(OnResolve, const_cast<Asyncable*>(caller), new ResolveCall<Call, T...>(f));
+        ptr()->subscribe(OnResolve, const_cast<Asyncable*>(caller), new ResolveCall<Call, T...>(f), delivery);
         return *this;
     }
 
     template<typename Call>
-    Promise<T...>& onReject(const Asyncable* caller, Call f)
+    Promise<T...>& onReject(const Asyncable* caller, Call f, Asyncable::Delivery delivery = Asyncable::Delivery::Queued)
     {
-        ptr()->addCallBack(OnReject, const_cast<Asyncable*>(caller), new RejectCall<Call>(f));
+        ptr()->subscribe(OnReject, const_cast<Asyncable*>(caller), new RejectCall<Call>(f), delivery);
         return *this;
     }
 
+    //! NOTE Continuations, they return a new promise which is resolved with the result of `f`,
+    //! a rejection is passed along the chain. A continuation runs on the thread where it was added,
+    //! if the promise is resolved on the same thread, it runs inline (without a queued delivery),
+    //! so a chain of steps costs no round-trips.
+
+    //! NOTE `f(T...)` returns a value (or nothing), the new promise is resolved with it
+    template<typename F>
+    auto map(F f) -> typename PromiseOf<std::invoke_result_t<F, const T&...> >::type
+    {
+        using R = std::invoke_result_t<F, const T&...>;
+        using Next = typename PromiseOf<R>::type;
+
+        Next next;
+        onResolveContinuation([next, f](auto&&... val) mutable {
+            if constexpr (std::is_void_v<R>) {
+                f(std::forward<decltype(val)>(val)...);
+                next.resolve();
+            } else {
+                next.resolve(f(std::forward<decltype(val)>(val)...));
+            }
+        });
+        forwardReject(next);
+        return next;
+    }
+
+    //! NOTE `f(T...)` returns a promise, the new promise is resolved (or rejected) with it
+    template<typename F>
+    auto flatMap(F f) -> std::invoke_result_t<F, const T&...>
+    {
+        using Next = std::invoke_result_t<F, const T&...>;
+        static_assert(IsPromise<Next>::value, "flatMap requires a function returning a Promise");
+
+        Next next;
+        onResolveContinuation([next, f](auto&&... val) mutable {
+            Next inner = f(std::forward<decltype(val)>(val)...);
+            inner.onResolveContinuation([next](auto&&... r) mutable {
+                next.resolve(std::forward<decltype(r)>(r)...);
+            });
+            inner.forwardReject(next);
+        });
+        forwardReject(next);
+        return next;
+    }
+
+    //! NOTE `flatMap` if `f` returns a promise, otherwise `map`
+    template<typename F>
+    auto then(F f)
+    {
+        if constexpr (IsPromise<std::invoke_result_t<F, const T&...> >::value) {
+            return flatMap(f);
+        } else {
+            return map(f);
+        }
+    }
+
+    //! NOTE The value of the promise in a combined result (see all)
+    using Value = typename ValueOf<T...>::type;
+
+    //! NOTE Combinators. The promises are observed on the threads which settle them,
+    //! the completion is counted with one atomic counter, so only the combined result
+    //! is delivered to the subscribers (instead of a delivery per promise).
+
+    //! NOTE Resolved with the values of all promises (in the same order) when all of them are resolved,
+    //! rejected with the first rejection
+    static Promise<std::vector<Value> > all(const std::vector<Promise<T...> >& promises)
+    {
+        struct State {
+            std::atomic<size_t> remaining = 0;
+            std::vector<std::optional<Value> > results;
+            Promise<std::vector<Value> > out;
+        };
+
+        auto state = std::make_shared<State>();
+        state->remaining.store(promises.size(), std::memory_order_relaxed);
+        state->results.resize(promises.size());
+        Promise<std::vector<Value> > out = state->out;
+
+        if (promises.empty()) {
+            out.resolve(std::vector<Value>());
+            return out;
+        }
+
+        for (size_t i = 0; i < promises.size(); ++i) {
+            Promise<T...> p = promises.at(i);
+            p.onResolveDirect([state, i](auto&&... val) {
+                state->results[i].emplace(std::forward<decltype(val)>(val)...);
+
+                //! NOTE Acq rel - the last one sees the results of all others
+                if (state->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    std::vector<Value> values;
+                    values.reserve(state->results.size());
+                    for (std::optional<Value>& r : state->results) {
+                        values.push_back(std::move(*r));
+                    }
+                    state->out.resolve(std::move(values));
+                }
+            });
+            p.onRejectDirect([state](int code, const std::string& msg) {
+                state->out.reject(code, msg);
+            });
+        }
+
+        return out;
+    }
+
+    //! NOTE Resolved with the first resolved value,
+    //! rejected (with the last rejection) when all promises are rejected
+    static Promise<T...> any(const std::vector<Promise<T...> >& promises)
+    {
+        struct State {
+            std::atomic<size_t> remaining = 0;
+            Promise<T...> out;
+        };
+
+        auto state = std::make_shared<State>();
+        state->remaining.store(promises.size(), std::memory_order_relaxed);
+        Promise<T...> out = state->out;
+
+        if (promises.empty()) {
+            out.reject(-1, "no promises");
+            return out;
+        }
+
+        for (Promise<T...> p : promises) {
+            p.onResolveDirect([state](auto&&... val) {
+                state->out.resolve(std::forward<decltype(val)>(val)...);
+            });
+            p.onRejectDirect([state](int code, const std::string& msg) {
+                if (state->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    state->out.reject(code, msg);
+                }
+            });
+        }
+
+        return out;
+    }
+
+    //! NOTE Settled as the first settled promise (resolved or rejected)
+    static Promise<T...> race(const std::vector<Promise<T...> >& promises)
+    {
+        Promise<T...> out;
+        for (Promise<T...> p : promises) {
+            p.onResolveDirect([out](auto&&... val) mutable {
+                out.resolve(std::forward<decltype(val)>(val)...);
+            });
+            p.onRejectDirect([out](int code, const std::string& msg) mutable {
+                out.reject(code, msg);
+            });
+        }
+        return out;
+    }
+
+#ifdef KORS_ASYNC_COROUTINES
+    //! NOTE `co_await promise` suspends the coroutine until the promise is settled,
+    //! the coroutine is resumed on the awaiting thread.
+    //! Returns the value (nothing for `Promise<>`, a tuple for several values), throws RejectedError if rejected
+    struct Awaiter {
+        Promise<T...> p;
+
+        bool await_ready() const
+        {
+            return p.ptr()->state() != Undefined;
+        }
+
+        bool await_suspend(std::coroutine_handle<> h) const
+        {
+            auto resume = [h](auto&&...) { h.resume(); };
+            return p.ptr()->subscribeIfPending(new ResolveCall<decltype(resume), T...>(resume),
+                                               new RejectCall<decltype(resume)>(resume));
+        }
+
+        auto await_resume() const
+        {
+            const std::shared_ptr<PromiseInvoker>& inv = p.ptr();
+            if (inv->state() == OnReject) {
+                const auto& e = inv->result().template args<int, std::string>();
+                throw RejectedError(std::get<0>(e), std::get<1>(e));
+            }
+
+            const auto& args = inv->result().template args<T...>();
+            if constexpr (sizeof...(T) == 0) {
+                return;
+            } else if constexpr (sizeof...(T) == 1) {
+                return std::get<0>(args);
+            } else {
+                return args;
+            }
+        }
+    };
+
+    Awaiter operator co_await() const
+    {
+        return Awaiter { *this };
+    }
+#endif
+
 private:
+    template<typename ... U>
+    friend class Promise;
+
+    template<typename Call>
+    void onResolveContinuation(Call f)
+    {
+        ptr()->subscribe(OnResolve, nullptr, new ResolveCall<Call, T...>(f), Asyncable::Delivery::Queued, true);
+    }
+
+    template<typename Call>
+    void onRejectContinuation(Call f)
+    {
+        ptr()->subscribe(OnReject, nullptr, new RejectCall<Call>(f), Asyncable::Delivery::Queued, true);
+    }
+
+    template<typename Call>
+    void onResolveDirect(Call f)
+    {
+        ptr()->subscribeDirect(OnResolve, new ResolveCall<Call, T...>(f));
+    }
+
+    template<typename Call>
+    void onRejectDirect(Call f)
+    {
+        ptr()->subscribeDirect(OnReject, new RejectCall<Call>(f));
+    }
+
     Promise() = default;
 
-    void resolve(const T& ... d)
+    template<typename Next>
+    void forwardReject(Next next)
+    {
+        onRejectContinuation([next](int code, const std::string& msg) mutable {
+            next.reject(code, msg);
+        });
+    }
+
+    template<typename ... V>
+    void resolve(V&&... d)
     {
-        NotifyData nd;
-        nd.setArg<T...>(0, d ...);
-        nd.setArg<std::shared_ptr<PromiseInvoker> >(1, ptr());
-        ptr()->invoke(OnResolve, nd);
+        NotifyData result;
+        result.setArgs<T...>(std::forward<V>(d)...);
+        m_ptr->settle(OnResolve, std::move(result), m_ptr);
     }
 
     void reject(int code, const std::string& msg)
     {
-        NotifyData nd;
-        nd.setArg<int>(0, code);
-        nd.setArg<std::string>(1, msg);
-        nd.setArg<std::shared_ptr<PromiseInvoker> >(2, ptr());
-        ptr()->invoke(OnReject, nd);
+        NotifyData result;
+        result.setArgs<int, std::string>(code, msg);
+        m_ptr->settle(OnReject, std::move(result), m_ptr);
     }
 
     enum CallType {
@@ -172,30 +449,20 @@ private:
         OnReject
     };
 
-    struct IResolve {
-        virtual ~IResolve() {}
-        virtual void resolved(const NotifyData& e) = 0;
-    };
-
     template<typename Call, typename ... Arg>
-    struct ResolveCall : public IResolve {
+    struct ResolveCall : public AbstractInvoker::ICall {
         Call f;
         ResolveCall(Call _f)
             : f(_f) {}
-        void resolved(const NotifyData& e) { std::apply(f, e.args<Arg...>()); }
-    };
-
-    struct IReject {
-        virtual ~IReject() {}
-        virtual void rejected(const NotifyData& e) = 0;
+        void call(const NotifyData& e) override { e.apply<Arg...>(f); }
     };
 
     template<typename Call>
-    struct RejectCall : public IReject {
+    struct RejectCall : public AbstractInvoker::ICall {
         Call f;
         RejectCall(Call _f)
             : f(_f) {}
-        void rejected(const NotifyData& e) { f(e.arg<int>(0), e.arg<std::string>(1)); }
+        void call(const NotifyData& e) override { e.apply<int, std::string>(f); }
     };
 
     struct PromiseInvoker : public AbstractInvoker
@@ -206,47 +473,191 @@ private:
         ~PromiseInvoker()
         {
             removeAllCallBacks();
+
+            for (const Direct& d : m_direct) {
+                d.call->release();
+            }
         }
 
-        void deleteCall(int _type, void* call) override
+        //! NOTE Subscribers added after the promise is settled get the stored result.
+        //! The continuations are anonymous, they don't replace each other (and a subscriber without a caller)
+        void subscribe(CallType type, Asyncable* caller, ICall* call, Asyncable::Delivery delivery, bool continuation = false)
         {
-            CallType type = static_cast<CallType>(_type);
-            switch (type) {
-            case Undefined: {} break;
-            case OnResolve: {
-                delete static_cast<IResolve*>(call);
-            } break;
-            case OnReject: {
-                delete static_cast<IReject*>(call);
-            } break;
+            CallType state = Undefined;
+            {
+                std::lock_guard<std::mutex> lock(m_stateMutex);
+                state = m_state;
+                if (state == Undefined) {
+                    addCallBack(type, caller, call, Asyncable::AsyncMode::AsyncSetRepeat, delivery == Asyncable::Delivery::Direct,
+                                continuation);
+                    return;
+                }
+            }
+
+            if (state == type) {
+                call->call(m_result);
             }
+            call->release();
         }
 
-        void doInvoke(int callKey, void* call, const NotifyData& d) override
+        //! NOTE Direct calls are called on the thread which settles the promise
+        //! (or right away, if it is already settled), without a queued delivery
+        void subscribeDirect(CallType type, ICall* call)
         {
-            CallType type = static_cast<CallType>(callKey);
-            switch (type) {
-            case Undefined:  break;
-            case OnResolve:
-                static_cast<IResolve*>(call)->resolved(d);
-                break;
-            case OnReject:
-                static_cast<IReject*>(call)->rejected(d);
-                break;
+            CallType state = Undefined;
+            {
+                std::lock_guard<std::mutex> lock(m_stateMutex);
+                state = m_state;
+                if (state == Undefined) {
+                    m_direct.push_back({ type, call });
+                    return;
+                }
             }
+
+            if (state == type) {
+                call->call(m_result);
+            }
+            call->release();
+        }
+
+        CallType state()
+        {
+            std::lock_guard<std::mutex> lock(m_stateMutex);
+            return m_state;
         }
+
+        //! NOTE Valid once the promise is settled
+        const NotifyData& result() const
+        {
+            return m_result;
+        }
+
+        //! NOTE Subscribes both calls (without a receiver) only if the promise is not settled yet
+        bool subscribeIfPending(ICall* resolveCall, ICall* rejectCall)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_stateMutex);
+                if (m_state == Undefined) {
+                    addCallBack(OnResolve, nullptr, resolveCall, Asyncable::AsyncMode::AsyncSetRepeat, false, true);
+                    addCallBack(OnReject, nullptr, rejectCall, Asyncable::AsyncMode::AsyncSetRepeat, false, true);
+                    return true;
+                }
+            }
+
+            resolveCall->release();
+            rejectCall->release();
+            return false;
+        }
+
+        //! NOTE Only the first resolve or reject has an effect.
+        //! The result is stored and delivered (it is not modified after that),
+        //! the queued deliveries keep the invoker alive (`self`) until they are delivered
+        void settle(CallType type, NotifyData&& result, const std::shared_ptr<PromiseInvoker>& self)
+        {
+            std::vector<Direct> direct;
+            {
+                std::lock_guard<std::mutex> lock(m_stateMutex);
+                if (m_state != Undefined) {
+                    return;
+                }
+                m_result = std::move(result);
+                m_state = type;
+                direct.swap(m_direct);
+            }
+
+            for (const Direct& d : direct) {
+                if (d.type == type) {
+                    d.call->call(m_result);
+                }
+                d.call->release();
+            }
+
+            AbstractInvoker::invoke(type, m_result, std::shared_ptr<void>(self));
+        }
+
+    private:
+        struct Direct {
+            CallType type = Undefined;
+            ICall* call = nullptr;
+        };
+
+        //! NOTE Guards the state against the subscription, the result is not modified once settled
+        std::mutex m_stateMutex;
+        CallType m_state = Undefined;
+        NotifyData m_result;
+        std::vector<Direct> m_direct;
     };
 
-    std::shared_ptr<PromiseInvoker> ptr() const
+    //! NOTE The invoker is created with the promise, so it is borrowed without touching its refcount
+    const std::shared_ptr<PromiseInvoker>& ptr() const
     {
-        if (!m_ptr) {
-            m_ptr = std::make_shared<PromiseInvoker>();
-        }
         return m_ptr;
     }
 
-    mutable std::shared_ptr<PromiseInvoker> m_ptr = nullptr;
+    std::shared_ptr<PromiseInvoker> m_ptr = AbstractInvoker::make<PromiseInvoker>();
+};
+
+#ifdef KORS_ASYNC_COROUTINES
+//! NOTE The promise of a coroutine returning `Promise<T...>`, the coroutine starts right away,
+//! `co_return` resolves the promise, an uncaught exception rejects it
+template<typename ... T>
+struct PromiseCoroutineBase {
+    Promise<T...> promise = Promise<T...>([](auto, auto) {
+        return Promise<T...>::Result::unchecked();
+    }, Promise<T...>::AsynchronyType::ProvidedByBody);
+
+    Promise<T...> get_return_object() { return promise; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+
+    void unhandled_exception()
+    {
+        typename Promise<T...>::Reject reject(promise);
+        try {
+            throw;
+        } catch (const RejectedError& e) {
+            (void)reject(e.code(), e.what());
+        } catch (const std::exception& e) {
+            (void)reject(-1, e.what());
+        } catch (...) {
+            (void)reject(-1, "unknown error");
+        }
+    }
+};
+
+template<typename ... T>
+struct PromiseCoroutine : public PromiseCoroutineBase<T...> {
+    void return_value(typename ValueOf<T...>::type value)
+    {
+        typename Promise<T...>::Resolve resolve(this->promise);
+        if constexpr (sizeof...(T) == 1) {
+            (void)resolve(std::move(value));
+        } else {
+            std::apply([&resolve](auto&&... val) {
+                (void)resolve(std::move(val)...);
+            }, std::move(value));
+        }
+    }
+};
+
+template<>
+struct PromiseCoroutine<> : public PromiseCoroutineBase<> {
+    void return_void()
+    {
+        Promise<>::Resolve resolve(promise);
+        (void)resolve();
+    }
+};
+#endif
+}
+
+#ifdef KORS_ASYNC_COROUTINES
+namespace std {
+template<typename ... T, typename ... Args>
+struct coroutine_traits<kors::async::Promise<T...>, Args...> {
+    using promise_type = kors::async::PromiseCoroutine<T...>;
 };
 }
+#endif
 
 #endif // KORS_ASYNC_PROMISE_H
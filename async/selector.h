@@ -0,0 +1,137 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef KORS_ASYNC_SELECTOR_H
+#define KORS_ASYNC_SELECTOR_H
+
+#include <memory>
+#include <vector>
+
+#include "channel.h"
+#include "notification.h"
+#include "internal/inbox.h"
+
+namespace kors::async {
+//! NOTE Listens to many channels at once: their values are queued into one inbox of the selector
+//! and delivered in one pass, in the send order, so the consumer thread is woken up once
+//! for a burst over all the sources instead of once per send per channel.
+//! By default the values are delivered by the processing of events of the thread which created the selector,
+//! a blocking selector is drained by `select` instead (for worker threads without an event loop)
+class Selector : public Asyncable
+{
+public:
+
+    using Mode = Inbox::Mode;
+
+    explicit Selector(Mode mode = Mode::Queued)
+        : m_inbox(std::make_shared<Inbox>(mode, std::this_thread::get_id())) {}
+
+    Selector(const Selector&) = delete;
+    Selector& operator=(const Selector&) = delete;
+
+    ~Selector()
+    {
+        //! NOTE The values already in the inbox are not delivered anymore
+        for (AbstractInvoker::ICall* h : m_handlers) {
+            h->cancel();
+            h->release();
+        }
+        disconnectAll();
+    }
+
+    template<typename ... T, typename Func>
+    void add(const Channel<T...>& ch, Func f)
+    {
+        AbstractInvoker::ICall* handler = new Handler<Func, T...>(f);
+        m_handlers.push_back(handler);
+        ch.ptr()->addCallBack(Channel<T...>::Receive, this, new Forward(m_inbox, handler),
+                              Asyncable::AsyncMode::AsyncSetRepeat, true);
+    }
+
+    template<typename Func>
+    void add(const Notification& n, Func f)
+    {
+        add(n.m_ch, f);
+    }
+
+    //! NOTE Values of the channel which are already in the inbox are still delivered
+    template<typename ... T>
+    void remove(const Channel<T...>& ch)
+    {
+        ch.ptr()->removeCallBack(Channel<T...>::Receive, this);
+    }
+
+    void remove(const Notification& n)
+    {
+        remove(n.m_ch);
+    }
+
+    //! NOTE Blocking selector only, from the thread which created it.
+    //! Waits for values (or until the timeout expires), delivers them, returns the number of the delivered values
+    size_t select()
+    {
+        std::shared_ptr<Inbox> inbox = m_inbox;
+        return inbox->select(nullptr);
+    }
+
+    size_t select(const std::chrono::microseconds& timeout)
+    {
+        std::shared_ptr<Inbox> inbox = m_inbox;
+        return inbox->select(&timeout);
+    }
+
+private:
+
+    template<typename Call, typename ... Arg>
+    struct Handler : public AbstractInvoker::ICall {
+        Call f;
+        Handler(Call _f)
+            : f(_f) {}
+        void call(const NotifyData& d) override { d.apply<Arg...>(f); }
+    };
+
+    //! NOTE Subscribed to a channel as a direct call, so it runs on the sending thread
+    struct Forward : public AbstractInvoker::ICall {
+        std::shared_ptr<Inbox> inbox;
+        AbstractInvoker::ICall* handler = nullptr;
+
+        Forward(const std::shared_ptr<Inbox>& i, AbstractInvoker::ICall* h)
+            : inbox(i), handler(h)
+        {
+            handler->addRef();
+        }
+
+        ~Forward()
+        {
+            handler->release();
+        }
+
+        void call(const NotifyData& d) override { inbox->push(handler, d); }
+    };
+
+    std::shared_ptr<Inbox> m_inbox;
+    std::vector<AbstractInvoker::ICall*> m_handlers;
+};
+}
+
+#endif // KORS_ASYNC_SELECTOR_H
@@ -0,0 +1,200 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef KORS_ASYNC_SHAREDCHANNEL_H
+#define KORS_ASYNC_SHAREDCHANNEL_H
+
+#include <array>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+
+#include "channel.h"
+#include "internal/sharedring.h"
+
+namespace kors::async {
+//! NOTE Channel between processes: the values are copied into a lock-free ring in a named shared memory segment,
+//! a thread of the receiving process pops them and sends them to the receivers as a local channel does
+//! (so they are delivered by `processEvents` of the receiver threads, or directly, see Asyncable::Delivery).
+//! The values must be trivially copyable, they are copied as bytes. The channels opened with the same name
+//! (and the same capacity, layout of the values and tag) in any processes share the ring,
+//! each value is received by one receiving process. A process reads the ring only while the channel has receivers.
+//! Linux only, otherwise the channel is not open
+template<typename ... T>
+class SharedChannel
+{
+    static_assert((std::is_trivially_copyable_v<T> && ...), "the values of a shared channel must be trivially copyable");
+
+public:
+    //! NOTE The layout of the values (their sizes and alignments) is checked when the segment is opened,
+    //! `tag` tells apart the channels with the same layout which mean different values
+    SharedChannel(const std::string& name, size_t capacity, uint64_t tag = 0)
+        : m_ptr(std::make_shared<Endpoint>(SharedRing::open(name, capacity, PAYLOAD_SIZE, signature(tag)))) {}
+
+    SharedChannel(const SharedChannel& ch)
+        : m_ptr(ch.m_ptr) {}
+    ~SharedChannel() {}
+
+    SharedChannel& operator=(const SharedChannel& ch)
+    {
+        m_ptr = ch.m_ptr;
+        return *this;
+    }
+
+    //! NOTE False if the segment could not be created or opened
+    //! (or it was created with another capacity, other types or another tag)
+    bool isOpen() const
+    {
+        return m_ptr->ring != nullptr;
+    }
+
+    //! NOTE Waits while the ring is full, returns false if the channel is not open
+    bool send(const T&... d)
+    {
+        return m_ptr->push(true, d ...);
+    }
+
+    //! NOTE Never waits, returns false if the ring is full
+    bool trySend(const T&... d)
+    {
+        return m_ptr->push(false, d ...);
+    }
+
+    //! NOTE The first receiver starts the reading of the ring in this process, it stops when there are no receivers
+    template<typename Func>
+    void onReceive(const Asyncable* receiver, Func f, Asyncable::AsyncMode mode = Asyncable::AsyncMode::AsyncSetOnce,
+                   Asyncable::Delivery delivery = Asyncable::Delivery::Queued)
+    {
+        m_ptr->local.onReceive(receiver, f, mode, delivery);
+        m_ptr->startReading();
+    }
+
+    void resetOnReceive(const Asyncable* receiver)
+    {
+        m_ptr->local.resetOnReceive(receiver);
+    }
+
+    //! NOTE Removes the name of the segment, the opened channels keep working
+    static bool unlink(const std::string& name)
+    {
+        return SharedRing::unlink(name);
+    }
+
+private:
+
+    static constexpr size_t PAYLOAD_SIZE = (sizeof(T) + ... + 0);
+
+    //! NOTE FNV-1a of the number of the values, their sizes and alignments, and the tag
+    static uint64_t signature(uint64_t tag)
+    {
+        uint64_t h = 14695981039346656037ull;
+        auto mix = [&h](uint64_t v) {
+            for (int i = 0; i < 8; ++i) {
+                h ^= (v >> (i * 8)) & 0xff;
+                h *= 1099511628211ull;
+            }
+        };
+
+        mix(sizeof...(T));
+        (mix(sizeof(T)), ...);
+        (mix(alignof(T)), ...);
+        mix(tag);
+        return h;
+    }
+
+    struct Endpoint : public std::enable_shared_from_this<Endpoint> {
+        std::shared_ptr<SharedRing> ring;
+        Channel<T...> local;
+
+        Endpoint(const std::shared_ptr<SharedRing>& r)
+            : ring(r) {}
+
+        ~Endpoint()
+        {
+            if (ring) {
+                ring->stopReading();
+            }
+        }
+
+        bool push(bool wait, const T&... d)
+        {
+            if (!ring) {
+                return false;
+            }
+
+            std::array<unsigned char, PAYLOAD_SIZE + 1> buf;
+            size_t offset = 0;
+            ((std::memcpy(buf.data() + offset, &d, sizeof(T)), offset += sizeof(T)), ...);
+            return ring->push(buf.data(), wait);
+        }
+
+        void startReading()
+        {
+            if (!ring) {
+                return;
+            }
+
+            //! NOTE The endpoint can be released by a direct receiver, on the reading thread,
+            //! so it is held only for a delivery. The values are not popped while there are no receivers,
+            //! other receiving processes get them then
+            std::weak_ptr<Endpoint> weak = this->weak_from_this();
+            ring->startReading([weak](SharedRing* r) {
+                std::array<unsigned char, PAYLOAD_SIZE + 1> buf;
+                for (;;) {
+                    std::shared_ptr<Endpoint> e = weak.lock();
+                    if (!e || !e->local.isConnected()) {
+                        return false;
+                    }
+
+                    if (!r->pop(buf.data())) {
+                        return true;
+                    }
+
+                    e->deliver(buf.data());
+                }
+            });
+        }
+
+        void deliver(const unsigned char* data)
+        {
+            std::tuple<T...> values;
+            size_t offset = 0;
+            std::apply([data, &offset](T&... v) {
+                ((std::memcpy(&v, data + offset, sizeof(T)), offset += sizeof(T)), ...);
+            }, values);
+            (void)data;
+            (void)offset;
+
+            std::apply([this](T&... v) {
+                local.send(v ...);
+            }, values);
+        }
+    };
+
+    std::shared_ptr<Endpoint> m_ptr;
+};
+}
+
+#endif // KORS_ASYNC_SHAREDCHANNEL_H
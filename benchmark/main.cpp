@@ -0,0 +1,395 @@
+/*
+MIT License
+
+Copyright (c) 2020 Igor Korsukov
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../async/asyncable.h"
+#include "../async/async.h"
+#include "../async/channel.h"
+#include "../async/changednotify.h"
+#include "../async/processevents.h"
+#include "../async/promise.h"
+
+using namespace kors::async;
+
+//! NOTE Counts the heap allocations, to report the allocations per operation
+static std::atomic<uint64_t> s_allocations = 0;
+
+void* operator new(size_t size)
+{
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+struct Receiver : public Asyncable {};
+
+//! NOTE One benchmark run: `ops` operations took `seconds`, the latencies are sampled per operation
+struct Result {
+    std::string name;
+    uint64_t ops = 0;
+    double seconds = 0;
+    std::vector<int64_t> latencies;
+    uint64_t allocations = 0;
+};
+
+class Measure
+{
+public:
+    explicit Measure(size_t samples)
+    {
+        latencies.reserve(samples);
+        m_allocations = s_allocations.load(std::memory_order_relaxed);
+        m_start = Clock::now();
+    }
+
+    Result finish(const std::string& name, uint64_t ops)
+    {
+        Result r;
+        r.seconds = std::chrono::duration<double>(Clock::now() - m_start).count();
+        r.allocations = s_allocations.load(std::memory_order_relaxed) - m_allocations;
+        r.name = name;
+        r.ops = ops;
+        r.latencies = std::move(latencies);
+        return r;
+    }
+
+    std::vector<int64_t> latencies;
+
+private:
+    uint64_t m_allocations = 0;
+    Clock::time_point m_start;
+};
+
+void print(Result r)
+{
+    std::sort(r.latencies.begin(), r.latencies.end());
+    auto percentile = [&r](double p) -> int64_t {
+        if (r.latencies.empty()) {
+            return 0;
+        }
+        return r.latencies.at(std::min(r.latencies.size() - 1, size_t(p * r.latencies.size())));
+    };
+
+    std::printf("%-48s %12.0f ops/s %9lld ns p50 %9lld ns p99 %8.2f allocs/op\n",
+                r.name.c_str(), r.ops / r.seconds,
+                (long long)percentile(0.5), (long long)percentile(0.99),
+                r.ops ? double(r.allocations) / r.ops : 0.0);
+}
+
+//! NOTE A thread running the loop of events, until it is destroyed
+class Worker
+{
+public:
+    Worker()
+    {
+        std::atomic<bool> started = false;
+        m_thread = std::thread([this, &started]() {
+            m_id = std::this_thread::get_id();
+            registerThread();
+            started = true;
+            runLoop();
+        });
+        while (!started) {
+            std::this_thread::yield();
+        }
+    }
+
+    ~Worker()
+    {
+        exitLoop(m_id);
+        m_thread.join();
+    }
+
+    std::thread::id id() const { return m_id; }
+
+    //! NOTE Runs `f` on the worker thread and waits for it
+    void exec(const std::function<void()>& f)
+    {
+        std::atomic<bool> done = false;
+        Async::call(nullptr, [&f, &done]() {
+            f();
+            done = true;
+        }, m_id);
+        while (!done) {
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    std::thread m_thread;
+    std::thread::id m_id;
+};
+
+void sameThreadSend(size_t n)
+{
+    Receiver r;
+    Channel<int> ch;
+    uint64_t sum = 0;
+    ch.onReceive(&r, [&sum](int v) { sum += v; });
+
+    Measure m(n);
+    for (size_t i = 0; i < n; ++i) {
+        int64_t start = nowNs();
+        ch.send(int(i));
+        m.latencies.push_back(nowNs() - start);
+    }
+    print(m.finish("channel send, same thread", n));
+}
+
+//! NOTE Each consumer receives every value, the latency is from the send to the receive
+void crossThreadSend(size_t producers, size_t consumers, size_t n)
+{
+    Channel<int64_t> ch;
+    std::vector<std::unique_ptr<Worker> > workers;
+    std::vector<std::unique_ptr<Receiver> > receivers(consumers);
+    std::vector<std::vector<int64_t> > latencies(consumers);
+    std::atomic<size_t> received = 0;
+    size_t total = producers * n;
+
+    for (size_t c = 0; c < consumers; ++c) {
+        workers.push_back(std::make_unique<Worker>());
+        latencies.at(c).reserve(total);
+        workers.back()->exec([&, c]() {
+            receivers.at(c) = std::make_unique<Receiver>();
+            ch.onReceive(receivers.at(c).get(), [&, c](int64_t sent) {
+                latencies.at(c).push_back(nowNs() - sent);
+                received.fetch_add(1, std::memory_order_relaxed);
+            });
+        });
+    }
+
+    Measure m(0);
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; ++p) {
+        threads.emplace_back([&ch, n]() {
+            for (size_t i = 0; i < n; ++i) {
+                ch.send(nowNs());
+            }
+        });
+    }
+
+    for (std::thread& t : threads) {
+        t.join();
+    }
+
+    while (received.load(std::memory_order_relaxed) < total * consumers) {
+        std::this_thread::yield();
+    }
+
+    for (const std::vector<int64_t>& l : latencies) {
+        m.latencies.insert(m.latencies.end(), l.begin(), l.end());
+    }
+
+    print(m.finish("channel send, " + std::to_string(producers) + " producers -> "
+                   + std::to_string(consumers) + " consumers", total * consumers));
+
+    for (size_t c = 0; c < consumers; ++c) {
+        workers.at(c)->exec([&, c]() { receivers.at(c).reset(); });
+    }
+}
+
+void fanOut(size_t receivers, size_t n)
+{
+    std::vector<Receiver> rs(receivers);
+    Channel<int> ch;
+    uint64_t sum = 0;
+    for (Receiver& r : rs) {
+        ch.onReceive(&r, [&sum](int v) { sum += v; });
+    }
+
+    Measure m(n);
+    for (size_t i = 0; i < n; ++i) {
+        int64_t start = nowNs();
+        ch.send(int(i));
+        m.latencies.push_back(nowNs() - start);
+    }
+    print(m.finish("fan-out to " + std::to_string(receivers) + " receivers (per send)", n));
+}
+
+void asyncCallRoundTrip(size_t n)
+{
+    Worker w;
+    Receiver r;
+    std::thread::id mainID = std::this_thread::get_id();
+
+    Measure m(n);
+    for (size_t i = 0; i < n; ++i) {
+        bool back = false;
+        int64_t start = nowNs();
+        Async::call(&r, [&r, &back, mainID]() {
+            Async::call(&r, [&back]() { back = true; }, mainID);
+        }, w.id());
+
+        while (!back) {
+            waitAndProcessEvents();
+        }
+        m.latencies.push_back(nowNs() - start);
+    }
+    print(m.finish("Async::call round-trip", n));
+}
+
+//! NOTE From the creation of the promise to the delivery of the result to the subscriber
+void promiseResolve(size_t n)
+{
+    Receiver r;
+
+    Measure m(n);
+    for (size_t i = 0; i < n; ++i) {
+        bool resolved = false;
+        int64_t start = nowNs();
+        Promise<int> p([](auto resolve, auto) {
+            return resolve(42);
+        }, ThreadPool::instance());
+        p.onResolve(&r, [&resolved](int) { resolved = true; });
+
+        while (!resolved) {
+            waitAndProcessEvents();
+        }
+        m.latencies.push_back(nowNs() - start);
+    }
+    print(m.finish("Promise resolve (thread pool)", n));
+}
+
+//! NOTE The latency is per batch, from `beginUpdate` to the delivery on the other thread
+void changedNotifierBulk(size_t batch, size_t n, bool batched)
+{
+    Worker w;
+    ChangedNotifier<int> notifier;
+    Receiver r;
+    std::atomic<size_t> received = 0;
+
+    w.exec([&]() {
+        if (batched) {
+            notifier.notify()->onItemsAdded(&r, [&received](const std::vector<int>& items) {
+                received.fetch_add(items.size(), std::memory_order_release);
+            });
+        } else {
+            notifier.notify()->onItemAdded(&r, [&received](int) {
+                received.fetch_add(1, std::memory_order_release);
+            });
+        }
+    });
+
+    Measure m(n);
+    for (size_t i = 0; i < n; ++i) {
+        int64_t start = nowNs();
+        if (batched) {
+            notifier.beginUpdate();
+        }
+        for (size_t j = 0; j < batch; ++j) {
+            notifier.itemAdded(int(j));
+        }
+        if (batched) {
+            notifier.endUpdate();
+        }
+
+        while (received.load(std::memory_order_acquire) < (i + 1) * batch) {
+            std::this_thread::yield();
+        }
+        m.latencies.push_back(nowNs() - start);
+    }
+    print(m.finish(std::string("ChangedNotifier ") + std::to_string(batch) + " items"
+                   + (batched ? ", batched (per item)" : " (per item)"), n * batch));
+
+    w.exec([&]() { r.disconnectAll(); });
+}
+
+void subscribeChurn(size_t n)
+{
+    Channel<int> ch;
+    Receiver stay;
+    ch.onReceive(&stay, [](int) {});
+
+    Measure m(n);
+    for (size_t i = 0; i < n; ++i) {
+        int64_t start = nowNs();
+        Receiver r;
+        ch.onReceive(&r, [](int) {});
+        ch.resetOnReceive(&r);
+        m.latencies.push_back(nowNs() - start);
+    }
+    print(m.finish("subscribe/unsubscribe", n));
+}
+}
+
+int main(int argc, char* argv[])
+{
+    //! NOTE `--quick` for a smoke run
+    size_t scale = (argc > 1 && std::strcmp(argv[1], "--quick") == 0) ? 100 : 1;
+
+    std::cout << "async benchmark (" << std::thread::hardware_concurrency() << " cores)" << std::endl;
+
+    sameThreadSend(1000000 / scale);
+
+    crossThreadSend(1, 1, 1000000 / scale);
+    crossThreadSend(4, 1, 250000 / scale);
+    crossThreadSend(1, 4, 250000 / scale);
+    crossThreadSend(4, 4, 100000 / scale);
+
+    fanOut(1, 1000000 / scale);
+    fanOut(10, 200000 / scale);
+    fanOut(1000, 2000 / scale);
+
+    asyncCallRoundTrip(100000 / scale);
+    promiseResolve(100000 / scale);
+
+    changedNotifierBulk(1000, 1000 / scale, false);
+    changedNotifierBulk(1000, 1000 / scale, true);
+
+    subscribeChurn(100000 / scale);
+
+    return 0;
+}
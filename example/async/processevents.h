@@ -9,10 +9,45 @@ inline void processEvents()
     kors::async::processEvents();
 }
 
+inline void waitAndProcessEvents(const std::chrono::microseconds& timeout)
+{
+    kors::async::waitAndProcessEvents(timeout);
+}
+
+inline void runLoop()
+{
+    kors::async::runLoop();
+}
+
+inline void registerThread()
+{
+    kors::async::registerThread();
+}
+
+inline void exitLoop()
+{
+    kors::async::exitLoop();
+}
+
 inline void onMainThreadInvoke(const std::function<void(const std::function<void()>& /*call*/, bool /*isAlwaysQueued*/)>& f)
 {
     kors::async::onMainThreadInvoke(f);
 }
+
+inline void setNotifier(const std::function<void()>& f)
+{
+    kors::async::setNotifier(f);
+}
+
+inline int eventFd()
+{
+    return kors::async::eventFd();
+}
+
+inline std::chrono::microseconds nextTimerTimeout()
+{
+    return kors::async::nextTimerTimeout();
+}
 }
 
 #endif // EXAMPLE_ASYNC_PROCESSEVENTS_H
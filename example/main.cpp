@@ -135,21 +135,16 @@ public:
                     channels.out.send(val1 + val2);
                 });
 
-                //! NOTE On close in channel, end running worker event loop imitation
-                bool th_running = true;
-                channels.in.onClose(this, [&th_running]() {
-                    th_running = false;
+                //! NOTE On close in channel, exit the worker event loop
+                channels.in.onClose(this, []() {
+                    app::async::exitLoop();
                 });
 
                 //! NOTE Send worker ready
                 channels.cmd.send("worker_ready");
 
-                //! NOTE Worker event loop imitation
-                while (th_running) {
-                    app::async::processEvents();
-                    std::this_thread::yield();
-                    std::this_thread::sleep_for(std::chrono::milliseconds(2));
-                }
+                //! NOTE Worker event loop, the thread sleeps until something is sent to it
+                app::async::runLoop();
 
                 channels.cmd.send("worker_finished");
             });